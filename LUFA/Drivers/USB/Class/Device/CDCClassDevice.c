@@ -282,6 +282,33 @@ int16_t CDC_Device_ReceiveByte(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInf
 	return ReceivedByte;
 }
 
+uint16_t CDC_Device_ReceiveData(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo,
+                                void* const Buffer,
+                                uint16_t Length)
+{
+	if ((USB_DeviceState != DEVICE_STATE_Configured) || !(CDCInterfaceInfo->State.LineEncoding.BaudRateBPS))
+	  return 0;
+
+	Endpoint_SelectEndpoint(CDCInterfaceInfo->Config.DataOUTEndpoint.Address);
+
+	if (!(Endpoint_IsOUTReceived()))
+	  return 0;
+
+	uint16_t BytesInEndpoint = Endpoint_BytesInEndpoint();
+
+	if (Length > BytesInEndpoint)
+	  Length = BytesInEndpoint;
+
+	uint8_t* DataStream = (uint8_t*)Buffer;
+	for (uint16_t i = Length; i > 0; i--)
+	  *(DataStream++) = Endpoint_Read_8();
+
+	if (Length == BytesInEndpoint)
+	  Endpoint_ClearOUT();
+
+	return Length;
+}
+
 void CDC_Device_SendControlLineStateChange(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo)
 {
 	if ((USB_DeviceState != DEVICE_STATE_Configured) || !(CDCInterfaceInfo->State.LineEncoding.BaudRateBPS))
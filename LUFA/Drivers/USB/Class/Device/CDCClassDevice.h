@@ -294,6 +294,24 @@
 			 */
 			int16_t CDC_Device_ReceiveByte(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo) ATTR_NON_NULL_PTR_ARG(1);
 
+			/** Reads a block of data from the host, up to the number of bytes remaining in the current OUT endpoint bank. This
+			 *  selects the endpoint once for the whole block, rather than once per byte as with repeated calls to
+			 *  \ref CDC_Device_ReceiveByte(). The bank is released back to the USB controller once all of its bytes are read. If no
+			 *  data is waiting to be read or if a USB host is not connected, the function returns zero.
+			 *
+			 *  \pre This function must only be called when the Device state machine is in the \ref DEVICE_STATE_Configured state or
+			 *       the call will fail.
+			 *
+			 *  \param[in,out] CDCInterfaceInfo  Pointer to a structure containing a CDC Class configuration and state.
+			 *  \param[out]    Buffer            Pointer to a buffer where the received data is to be stored.
+			 *  \param[in]     Length            Maximum number of bytes to read into the buffer.
+			 *
+			 *  \return Number of bytes read into the buffer, or zero if no data received.
+			 */
+			uint16_t CDC_Device_ReceiveData(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo,
+			                                void* const Buffer,
+			                                uint16_t Length) ATTR_NON_NULL_PTR_ARG(1) ATTR_NON_NULL_PTR_ARG(2);
+
 			/** Flushes any data waiting to be sent, ensuring that the send buffer is cleared.
 			 *
 			 *  \pre This function must only be called when the Device state machine is in the \ref DEVICE_STATE_Configured state or
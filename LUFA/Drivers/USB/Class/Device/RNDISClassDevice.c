@@ -79,7 +79,8 @@ void RNDIS_Device_ProcessControlRequest(USB_ClassInfo_RNDIS_Device_t* const RNDI
 	switch (USB_ControlRequest.bRequest)
 	{
 		case RNDIS_REQ_SendEncapsulatedCommand:
-			if (USB_ControlRequest.bmRequestType == (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE))
+			if ((USB_ControlRequest.bmRequestType == (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE)) &&
+			    (USB_ControlRequest.wLength <= RNDISInterfaceInfo->Config.MessageBufferLength))
 			{
 				Endpoint_ClearSETUP();
 				Endpoint_Read_Control_Stream_LE(RNDISInterfaceInfo->Config.MessageBuffer, USB_ControlRequest.wLength);
@@ -471,6 +472,60 @@ uint8_t RNDIS_Device_ReadPacket(USB_ClassInfo_RNDIS_Device_t* const RNDISInterfa
 	return ENDPOINT_RWSTREAM_NoError;
 }
 
+uint8_t RNDIS_Device_ReceivePacket(USB_ClassInfo_RNDIS_Device_t* const RNDISInterfaceInfo,
+                                   void* Buffer,
+                                   const uint16_t BufferLength,
+                                   uint16_t* const PacketLength)
+{
+	if ((USB_DeviceState != DEVICE_STATE_Configured) ||
+	    (RNDISInterfaceInfo->State.CurrRNDISState != RNDIS_Data_Initialized))
+	{
+		return ENDPOINT_RWSTREAM_DeviceDisconnected;
+	}
+
+	Endpoint_SelectEndpoint(RNDISInterfaceInfo->Config.DataOUTEndpoint.Address);
+
+	*PacketLength = 0;
+
+	if (!(Endpoint_IsOUTReceived()))
+		return ENDPOINT_RWSTREAM_NoError;
+
+	/* Skip any zero length packet that the host sent to terminate the previous transfer */
+	if (!(Endpoint_BytesInEndpoint()))
+	{
+		Endpoint_ClearOUT();
+		return ENDPOINT_RWSTREAM_NoError;
+	}
+
+	RNDIS_Packet_Message_t RNDISPacketHeader;
+	Endpoint_Read_Stream_LE(&RNDISPacketHeader, sizeof(RNDIS_Packet_Message_t), NULL);
+
+	if (le32_to_cpu(RNDISPacketHeader.DataLength) > ETHERNET_FRAME_SIZE_MAX)
+	{
+		Endpoint_StallTransaction();
+
+		return RNDIS_ERROR_LOGICAL_CMD_FAILED;
+	}
+
+	uint16_t DataLength = (uint16_t)le32_to_cpu(RNDISPacketHeader.DataLength);
+
+	/* Drop packets that are too large for the buffer, leaving the packet length as zero */
+	if (DataLength > BufferLength)
+	{
+		Endpoint_Discard_Stream(DataLength, NULL);
+		Endpoint_ClearOUT();
+
+		return ENDPOINT_RWSTREAM_NoError;
+	}
+
+	*PacketLength = DataLength;
+
+	Endpoint_Read_Stream_LE(Buffer, DataLength, NULL);
+	Endpoint_ClearOUT();
+
+	return ENDPOINT_RWSTREAM_NoError;
+}
+
 uint8_t RNDIS_Device_SendPacket(USB_ClassInfo_RNDIS_Device_t* const RNDISInterfaceInfo,
                                 void* Buffer,
                                 const uint16_t PacketLength)
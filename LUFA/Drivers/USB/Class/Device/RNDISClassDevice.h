@@ -156,6 +156,25 @@
 											void* Buffer,
 											uint16_t* const PacketLength) ATTR_NON_NULL_PTR_ARG(1);
 
+			/** Retrieves the next pending packet from the device in the same way as \ref RNDIS_Device_ReadPacket(), but
+			 *  never writes more than \c BufferLength bytes to the buffer. Packets that are larger than the buffer are read
+			 *  from the endpoint and dropped, and reported with a length of zero.
+			 *
+			 *  \pre This function must only be called when the Device state machine is in the \ref DEVICE_STATE_Configured state or the
+			 *       call will fail.
+			 *
+			 *  \param[in,out] RNDISInterfaceInfo  Pointer to a structure containing an RNDIS Class configuration and state.
+			 *  \param[out]    Buffer              Pointer to a buffer where the packer data is to be written to.
+			 *  \param[in]     BufferLength        Length in bytes of the buffer.
+			 *  \param[out]    PacketLength        Pointer to where the length in bytes of the read packet is to be stored.
+			 *
+			 *  \return A value from the \ref Endpoint_Stream_RW_ErrorCodes_t enum.
+			 */
+			uint8_t RNDIS_Device_ReceivePacket(USB_ClassInfo_RNDIS_Device_t* const RNDISInterfaceInfo,
+											   void* Buffer,
+											   const uint16_t BufferLength,
+											   uint16_t* const PacketLength) ATTR_NON_NULL_PTR_ARG(1);
+
 			/** Sends the given packet to the attached RNDIS device, after adding a RNDIS packet message header.
 			 *
 			 *  \pre This function must only be called when the Device state machine is in the \ref DEVICE_STATE_Configured state or the
@@ -194,6 +194,50 @@ uint8_t Endpoint_WaitUntilReady(void)
 		}
 	}
 }
+
+uint8_t Endpoint_WaitUntilReady_Bounded(const uint16_t TimeoutMS,
+                                        bool (* const AbortCheck)(void))
+{
+	uint16_t TimeoutMSRem        = TimeoutMS;
+	uint16_t PreviousFrameNumber = USB_Device_GetFrameNumber();
+
+	for (;;)
+	{
+		if (Endpoint_GetEndpointDirection() == ENDPOINT_DIR_IN)
+		{
+			if (Endpoint_IsINReady())
+			  return ENDPOINT_READYWAIT_NoError;
+		}
+		else
+		{
+			if (Endpoint_IsOUTReceived())
+			  return ENDPOINT_READYWAIT_NoError;
+		}
+
+		uint8_t USB_DeviceState_LCL = USB_DeviceState;
+
+		if (USB_DeviceState_LCL == DEVICE_STATE_Unattached)
+		  return ENDPOINT_READYWAIT_DeviceDisconnected;
+		else if (USB_DeviceState_LCL == DEVICE_STATE_Suspended)
+		  return ENDPOINT_READYWAIT_BusSuspended;
+		else if (Endpoint_IsStalled())
+		  return ENDPOINT_READYWAIT_EndpointStalled;
+
+		if ((AbortCheck != NULL) && AbortCheck())
+		  return ENDPOINT_READYWAIT_Aborted;
+
+		if (!(TimeoutMSRem))
+		  return ENDPOINT_READYWAIT_Timeout;
+
+		uint16_t CurrentFrameNumber = USB_Device_GetFrameNumber();
+
+		if (CurrentFrameNumber != PreviousFrameNumber)
+		{
+			PreviousFrameNumber = CurrentFrameNumber;
+			TimeoutMSRem--;
+		}
+	}
+}
 #endif
 
 #endif
@@ -159,6 +159,10 @@
 				                                                 *   within the software timeout period set by the
 				                                                 *   \ref USB_STREAM_TIMEOUT_MS macro.
 				                                                 */
+				ENDPOINT_READYWAIT_Aborted                 = 6, /**< The caller's abort check requested that the wait
+				                                                 *   be abandoned before the endpoint became ready
+				                                                 *   (see \ref Endpoint_WaitUntilReady_Bounded()).
+				                                                 */
 			};
 
 		/* Inline Functions: */
@@ -808,6 +812,23 @@
 			 */
 			uint8_t Endpoint_WaitUntilReady(void);
 
+			/** Spin-loops until the currently selected non-control endpoint is ready for the next packet of data
+			 *  to be read or written to it, like \ref Endpoint_WaitUntilReady(), but with a caller supplied timeout
+			 *  and an optional check that can abandon the wait early (e.g. when the host closes the port).
+			 *
+			 *  \note This routine should not be called on CONTROL type endpoints.
+			 *
+			 *  \ingroup Group_EndpointRW_AVR8
+			 *
+			 *  \param[in] TimeoutMS   Maximum number of USB frames (milliseconds) to wait, or zero to check the
+			 *                         endpoint once without waiting.
+			 *  \param[in] AbortCheck  Function returning \c true if the wait should be abandoned, or \c NULL.
+			 *
+			 *  \return A value from the \ref Endpoint_WaitUntilReady_ErrorCodes_t enum.
+			 */
+			uint8_t Endpoint_WaitUntilReady_Bounded(const uint16_t TimeoutMS,
+			                                        bool (* const AbortCheck)(void));
+
 	/* Disable C linkage for C++ Compilers: */
 		#if defined(__cplusplus)
 			}
@@ -0,0 +1,153 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#if ADC_TELEMETRY
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <util/atomic.h>
+#include <LUFA/Drivers/Peripheral/ADC.h>
+#include "adc.h"
+#include "protocol.h"
+#include "usb.h"
+
+// The supply is measured on A0 (ADC7) and the relay coil on A1 (ADC6)
+// through external ADC_DIVIDER:1 voltage dividers, against the internal
+// 2.56V reference so that the readings don't depend on the supply
+static const uint8_t input_channels[ADC_INPUT_COUNT] = { 7, 6 };
+#define ADC_MUX(channel) (ADC_REFERENCE_INT2560MV | ADC_RIGHT_ADJUSTED | ((channel) << MUX0))
+
+// Free-running conversions take 104us, so each input is averaged over
+// 64 conversions (6.7ms) before switching to the other input
+#define ADC_DECIMATION_SHIFT 6
+
+// Conversions to ignore while the reference settles after startup
+#define ADC_STARTUP_DISCARD 16
+
+typedef struct
+{
+    // Moving average of the decimated readings, scaled by 16
+    // Each new reading has a weight of 1/8
+    uint16_t filtered;
+
+    // Smallest and largest decimated readings since the last report
+    uint16_t min;
+    uint16_t max;
+} adc_input_t;
+
+static adc_input_t inputs[ADC_INPUT_COUNT];
+static uint8_t current_input = 0;
+static uint16_t sum = 0;
+static uint8_t count = 0;
+static uint8_t discard = ADC_STARTUP_DISCARD;
+
+void adc_initialize(void)
+{
+    for (uint8_t i = 0; i < ADC_INPUT_COUNT; i++)
+    {
+        inputs[i].filtered = ADC_NO_READING;
+        inputs[i].min = ADC_NO_READING;
+        inputs[i].max = 0;
+        ADC_SetupChannel(input_channels[i]);
+    }
+
+    ADC_Init(ADC_FREE_RUNNING | ADC_PRESCALE_128);
+    ADCSRA |= _BV(ADIE);
+    ADC_StartReading(ADC_MUX(input_channels[current_input]));
+}
+
+// Convert a reading (scaled by 16) to millivolts at the divider input
+static uint16_t to_millivolts(uint16_t reading)
+{
+    if (reading == ADC_NO_READING)
+        return ADC_NO_READING;
+
+    return ((uint32_t)reading * 2560 * ADC_DIVIDER) >> 14;
+}
+
+// Filtered voltage for one of the inputs, or ADC_NO_READING
+// Must only be called with interrupts disabled
+uint16_t adc_millivolts(uint8_t input)
+{
+    return to_millivolts(inputs[input].filtered);
+}
+
+// Send the voltages to the host: CMD, then the filtered, minimum and maximum
+// millivolts for each input as little-endian words. The minimum and maximum are reset.
+void adc_report(void)
+{
+    uint8_t report[1 + 6 * ADC_INPUT_COUNT] = { CMD_REPORT_ADC };
+    uint8_t length = 1;
+
+    for (uint8_t i = 0; i < ADC_INPUT_COUNT; i++)
+    {
+        adc_input_t input;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            input = inputs[i];
+            inputs[i].min = ADC_NO_READING;
+            inputs[i].max = 0;
+        }
+
+        uint16_t values[] =
+        {
+            to_millivolts(input.filtered),
+            input.min == ADC_NO_READING ? ADC_NO_READING : to_millivolts(input.min << 4),
+            input.min == ADC_NO_READING ? ADC_NO_READING : to_millivolts(input.max << 4)
+        };
+
+        for (uint8_t j = 0; j < 3; j++)
+        {
+            report[length++] = values[j] & 0xFF;
+            report[length++] = values[j] >> 8;
+        }
+    }
+
+    usb_write_data(report, length);
+}
+
+ISR(ADC_vect)
+{
+    uint16_t value = ADC_GetResult();
+
+    // The conversion after a channel switch was started before the switch
+    if (discard > 0)
+    {
+        discard--;
+        return;
+    }
+
+    sum += value;
+    if (++count < _BV(ADC_DECIMATION_SHIFT))
+        return;
+
+    adc_input_t *input = &inputs[current_input];
+    uint16_t reading = sum >> ADC_DECIMATION_SHIFT;
+    sum = 0;
+    count = 0;
+
+    if (input->filtered == ADC_NO_READING)
+        input->filtered = reading << 4;
+    else
+        input->filtered = input->filtered - (input->filtered >> 3) + (reading << 1);
+
+    if (reading < input->min)
+        input->min = reading;
+    if (reading > input->max)
+        input->max = reading;
+
+    // Move on to the next input
+    if (++current_input == ADC_INPUT_COUNT)
+        current_input = 0;
+
+    ADMUX = ADC_MUX(input_channels[current_input]);
+    discard = 1;
+}
+
+#endif
@@ -0,0 +1,25 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#include <stdint.h>
+
+#ifndef DOME_HEARTBEAT_ADC_H
+#define DOME_HEARTBEAT_ADC_H
+
+// Measured voltages
+#define ADC_SUPPLY      0
+#define ADC_RELAY_COIL  1
+#define ADC_INPUT_COUNT 2
+
+// Returned when a voltage hasn't been measured yet
+#define ADC_NO_READING  UINT16_MAX
+
+void adc_initialize(void);
+uint16_t adc_millivolts(uint8_t input);
+void adc_report(void);
+
+#endif
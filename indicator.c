@@ -0,0 +1,92 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdint.h>
+#include "indicator.h"
+
+// The status LED is on PC7/OC4A, so it can be blinked by the
+// timer4 PWM hardware without any help from the CPU
+#define BLINKER_LED_INIT DDRC |= _BV(DDC7), PORTC &= ~_BV(PC7)
+
+// Timer4 ticks at 16MHz / 16384 = 976.5625Hz
+// The 10 bit counter limits the longest blink period to ~1 second
+typedef struct
+{
+    uint16_t period;
+    uint16_t on;
+} indicator_pattern_t;
+
+static const indicator_pattern_t patterns[] PROGMEM =
+{
+    [INDICATOR_DISABLED] = { .period = 976, .on = 488 }, // 1Hz, equal on/off
+    [INDICATOR_ARMED]    = { .period = 976, .on = 878 }, // 1Hz, short off blink
+    [INDICATOR_WARNING]  = { .period = 244, .on = 122 }, // 4Hz, equal on/off
+    [INDICATOR_CLOSING]  = { .period = 488, .on = 244 }, // 2Hz, equal on/off
+    [INDICATOR_TRIPPED]  = { .period = 976, .on = 98 },  // 1Hz, short on flash
+};
+
+static uint8_t current_pattern = 0xFF;
+
+// Timer4 clocks (1.5 seconds) that the LED keeps blinking for after the last
+// pattern update from the timer1 tick. If the tick stops, the blinking stops
+// too, instead of the timer4 hardware blinking on for a firmware that is stuck
+#define INDICATOR_REFRESH_CLOCKS 1465
+static volatile uint16_t refresh_clocks = 0;
+
+void indicator_initialize(void)
+{
+    BLINKER_LED_INIT;
+
+    // Fast PWM that sets OC4A at BOTTOM and clears it on compare match
+    // COM4A0 must stay clear so that the relay on OC4A-bar (PC6) is left alone
+    TCCR4A = _BV(COM4A1) | _BV(PWM4A);
+    TCCR4D = 0;
+    indicator_set_pattern(INDICATOR_DISABLED);
+    TIMSK4 = _BV(TOIE4);
+    TCCR4B = _BV(CS43) | _BV(CS42) | _BV(CS41) | _BV(CS40);
+}
+
+// Change the blink pattern, and keep the LED blinking for another INDICATOR_REFRESH_CLOCKS
+// Must be called with interrupts disabled because the 10 bit
+// timer4 registers share a single TC4H high byte register
+void indicator_set_pattern(uint8_t pattern)
+{
+    refresh_clocks = INDICATOR_REFRESH_CLOCKS;
+    TCCR4A |= _BV(COM4A1);
+
+    if (pattern == current_pattern)
+        return;
+
+    uint16_t period = pgm_read_word(&patterns[pattern].period);
+    uint16_t on = pgm_read_word(&patterns[pattern].on);
+
+    // OCR4A and OCR4C are double buffered and update at the end of the current period
+    TC4H = period >> 8;
+    OCR4C = period & 0xFF;
+    TC4H = on >> 8;
+    OCR4A = on & 0xFF;
+
+    current_pattern = pattern;
+}
+
+ISR(TIMER4_OVF_vect)
+{
+    // Runs at the end of each blink period
+    uint16_t period = pgm_read_word(&patterns[current_pattern].period) + 1;
+    if (refresh_clocks > period)
+        refresh_clocks -= period;
+    else
+    {
+        // The timer1 tick has stopped updating the pattern, so
+        // disconnect the LED from the PWM output and leave it off
+        TCCR4A &= ~_BV(COM4A1);
+        refresh_clocks = 0;
+    }
+}
@@ -0,0 +1,23 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#include <stdint.h>
+
+#ifndef DOME_HEARTBEAT_INDICATOR_H
+#define DOME_HEARTBEAT_INDICATOR_H
+
+// Blink patterns for the status LED
+#define INDICATOR_DISABLED 0
+#define INDICATOR_ARMED    1
+#define INDICATOR_WARNING  2
+#define INDICATOR_CLOSING  3
+#define INDICATOR_TRIPPED  4
+
+void indicator_initialize(void);
+void indicator_set_pattern(uint8_t pattern);
+
+#endif
@@ -7,18 +7,58 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
 #include <util/delay.h>
+#include <util/crc16.h>
 #include <math.h>
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include "usb.h"
 #include "serial.h"
+#include "protocol.h"
+#include "sniffer.h"
+#include "indicator.h"
+#include "memory.h"
+#include "stats.h"
+#if PROFILE
+#include "profile.h"
+#endif
+#if TWI_BUS
+#include "twi.h"
+#endif
+#if ADC_TELEMETRY
+#include "adc.h"
+#endif
+#if MASS_STORAGE
+#include "storage.h"
+#endif
+#if NETWORK
+#include "network.h"
+#endif
+
+#if LOW_VOLTAGE_TRIP_MV && !ADC_TELEMETRY
+#error LOW_VOLTAGE_TRIP_MV requires ADC_TELEMETRY
+#endif
 
 #define RELAY_DISABLED PORTC &= ~_BV(PC6)
 #define RELAY_ENABLED  PORTC |= _BV(PC6)
-#define RELAY_INIT     DDRC |= _BV(DDC6), RELAY_DISABLED
+
+// In bridge mode the dome is always connected to the Arduino
+// and the PC talks to it through the second USB serial port
+#if BRIDGE_MODE
+#define RELAY_IDLE     RELAY_ENABLED
+#else
+#define RELAY_IDLE     RELAY_DISABLED
+#endif
+#define RELAY_INIT     DDRC |= _BV(DDC6), RELAY_IDLE
+
+// Keep this many bytes free in the serial send buffer for the close commands
+// sent from the ISR, which can't wait for the buffer to drain
+#define BRIDGE_SERIAL_RESERVE 8
 
 #if EXTERNAL_SIREN
 #define SIREN_DISABLED PORTB &= ~_BV(PB2)
@@ -30,17 +70,33 @@
 #define SIREN_INIT     DDRE |= _BV(DDE6), SIREN_DISABLED
 #endif
 
-#define BLINKER_LED_DISABLED PORTC &= ~_BV(PC7)
-#define BLINKER_LED_ENABLED  PORTC |= _BV(PC7)
-#define BLINKER_LED_INIT     DDRC |= _BV(DDC7), BLINKER_LED_DISABLED
-
 #define HEARTBEAT_LED_DISABLED  PORTD &= ~_BV(PD4), PORTD &= ~_BV(PD7)
 #define HEARTBEAT_LED_ENABLED   PORTD |= _BV(PD4), PORTD &= ~_BV(PD7)
 #define HEARTBEAT_LED_TRIGGERED PORTD &= ~_BV(PD4), PORTD |= _BV(PD7)
 #define HEARTBEAT_LED_INIT      DDRD |= _BV(DDD4) | _BV(DDD7), HEARTBEAT_LED_DISABLED
 
-// Number of seconds remaining until triggering the force-close
-volatile uint8_t heartbeat = 0;
+// Fast-close input on D8, pulled up internally and asserted by pulling to ground
+#define FAST_CLOSE_ASSERTED (!(PINB & _BV(PINB4)))
+#define FAST_CLOSE_INIT     DDRB &= ~_BV(DDB4), PORTB |= _BV(PB4), PCMSK0 |= _BV(PCINT4), PCICR |= _BV(PCIE0)
+
+// The input must still be asserted this many timer1 clocks (64us)
+// after its last edge before the dome is closed
+#define FAST_CLOSE_DEBOUNCE_CLOCKS 8
+
+// Number of independent heartbeat leases that clients can hold
+// Lease 0 is updated by the single-byte heartbeat ping
+// Must be no more than 8 so that the expired leases fit in a bitmask
+#define LEASE_COUNT 4
+
+#define LEASE_POLICY_ANY_EXPIRED 0
+#define LEASE_POLICY_ALL_EXPIRED 1
+
+// Number of half-seconds remaining on each lease until it expires
+// 0 means that the lease is not held
+volatile uint8_t leases[LEASE_COUNT];
+
+// Bitmask of the leases that have expired since the sticky trigger was last cleared
+volatile uint8_t expired_leases = 0;
 
 // Indicated whether the actively triggered and force-closing dome
 volatile bool active = false;
@@ -55,56 +111,671 @@ volatile uint8_t shutter_b_close_steps = 0;
 volatile uint8_t relay_reset_steps = 0;
 volatile uint8_t enable_siren_steps = 0;
 
+// Number of close steps that have been sent to each shutter during the current close
+// and whether the shutter has reported that it is closed
+volatile uint8_t shutter_a_sent_steps = 0;
+volatile uint8_t shutter_b_sent_steps = 0;
+volatile bool shutter_a_confirmed = false;
+volatile bool shutter_b_confirmed = false;
+
+// Largest number of close steps that each shutter has needed before reporting closed
+// 0 means that a close hasn't been observed and the full MAX_SHUTTER_CLOSE_STEPS is used
+uint8_t EEMEM shutter_a_learned_steps_eeprom = 0;
+uint8_t EEMEM shutter_b_learned_steps_eeprom = 0;
+volatile uint8_t shutter_a_learned_steps = 0;
+volatile uint8_t shutter_b_learned_steps = 0;
+
+// EEPROM writes are too slow for the ISR, so defer them to the main loop
+volatile bool calibration_changed = false;
+
+// Timeout that each held lease was taken with, for restoring it from EEPROM
+uint8_t lease_timeouts[LEASE_COUNT];
+
+// The heartbeat and close state are mirrored into RAM that isn't cleared at boot,
+// so that a watchdog, brown-out or reset button reset can carry on exactly where it left off
+typedef struct
+{
+    uint8_t leases[LEASE_COUNT];
+    uint8_t lease_timeouts[LEASE_COUNT];
+    uint8_t expired_leases;
+    bool triggered;
+    bool active;
+    uint8_t shutter_a_close_steps;
+    uint8_t shutter_b_close_steps;
+    uint8_t relay_reset_steps;
+    uint8_t shutter_a_sent_steps;
+    uint8_t shutter_b_sent_steps;
+    bool shutter_a_confirmed;
+    bool shutter_b_confirmed;
+} mirrored_state_t;
+
+// The checksum rejects the random contents of the RAM after a power cycle
+mirrored_state_t state_mirror __attribute__((section(".noinit")));
+uint16_t state_mirror_checksum __attribute__((section(".noinit")));
+
+// If the mirror was lost the armed leases and trip state are restored from EEPROM
+// This is only written when a lease is taken or released, the heartbeat trips,
+// a close finishes, or the trip is cleared, to limit the EEPROM wear
+typedef struct
+{
+    uint8_t lease_timeouts[LEASE_COUNT];
+    bool triggered;
+    bool active;
+    uint16_t checksum;
+} saved_state_t;
+
+saved_state_t EEMEM saved_state_eeprom;
+saved_state_t saved_state;
+
+#if LOW_VOLTAGE_TRIP_MV
+// The supply must stay below LOW_VOLTAGE_TRIP_MV for this many
+// timer1 ticks (0.5 seconds) before the dome is closed
+#define LOW_VOLTAGE_TRIP_TICKS 2
+uint8_t low_voltage_ticks = 0;
+#endif
+
+// Multi-byte commands collect their argument bytes over several reads
+uint8_t pending_command = 0;
+uint8_t pending_args[3];
+uint8_t pending_arg_count = 0;
+uint8_t pending_arg_length = 0;
+
+// Number of timer1 ticks since the last byte of a multi-byte command
+// A command is discarded if its next argument byte doesn't arrive within a tick
+volatile uint8_t pending_command_ticks = 0;
+
+#if TWI_BUS
+// Device register read requested by the host
+// The result is reported from the main loop once the transaction completes
+#define TWI_READ_MAX 8
+uint8_t twi_read_register;
+uint8_t twi_read_buffer[TWI_READ_MAX];
+volatile bool twi_read_finished = false;
+
+static void twi_read_complete(twi_transaction_t *transaction)
+{
+    twi_read_finished = true;
+}
+
+twi_transaction_t twi_read =
+{
+    .write_data = &twi_read_register,
+    .write_length = 1,
+    .read_data = twi_read_buffer,
+    .callback = twi_read_complete,
+};
+#endif
+
 // Rate limit the status reports to the host PC to 2Hz
 volatile bool send_status_byte = false;
 
-void poll_usb(void)
+#if NETWORK
+// Last state announced to the network: the status byte, but with every
+// heartbeat countdown value (1-240) treated as the same enabled state
+uint8_t network_state = 0;
+#endif
+
+// Number of steps to send before giving up on a shutter reporting closed
+static uint8_t close_step_budget(uint8_t learned_steps)
 {
-    // Check for ping or disable bytes from the host PC
-    while (usb_can_read())
+    if (learned_steps == 0 || learned_steps + CLOSE_STEP_MARGIN > MAX_SHUTTER_CLOSE_STEPS)
+        return MAX_SHUTTER_CLOSE_STEPS;
+
+    return learned_steps + CLOSE_STEP_MARGIN;
+}
+
+// Only ever grow the learned value: a close that starts from a partially open
+// position needs fewer steps and must not shrink the budget for a fully open dome
+static uint8_t learn_close_steps(uint8_t learned_steps, uint8_t sent_steps)
+{
+    if (sent_steps <= learned_steps)
+        return learned_steps;
+
+    calibration_changed = true;
+    return sent_steps;
+}
+
+static void load_calibration(void)
+{
+    shutter_a_learned_steps = eeprom_read_byte(&shutter_a_learned_steps_eeprom);
+    shutter_b_learned_steps = eeprom_read_byte(&shutter_b_learned_steps_eeprom);
+
+    // Unprogrammed EEPROM reads as 0xFF
+    if (shutter_a_learned_steps > MAX_SHUTTER_CLOSE_STEPS)
+        shutter_a_learned_steps = 0;
+    if (shutter_b_learned_steps > MAX_SHUTTER_CLOSE_STEPS)
+        shutter_b_learned_steps = 0;
+}
+
+static void save_calibration(void)
+{
+    // Clear the flag first so that a change from the ISR during the write isn't lost
+    calibration_changed = false;
+    eeprom_update_byte(&shutter_a_learned_steps_eeprom, shutter_a_learned_steps);
+    eeprom_update_byte(&shutter_b_learned_steps_eeprom, shutter_b_learned_steps);
+}
+
+// CRC of a saved state, seeded with its size so that a
+// state saved by a firmware with a different layout is rejected
+static uint16_t state_checksum(const void *state, uint8_t length)
+{
+    uint16_t crc = 0xFFFF ^ length;
+    const uint8_t *data = state;
+    for (uint8_t i = 0; i < length; i++)
+        crc = _crc16_update(crc, data[i]);
+
+    return crc;
+}
+
+// Copy the heartbeat and close state to the mirror
+// Must only be called with interrupts disabled
+static void mirror_state(void)
+{
+    for (uint8_t i = 0; i < LEASE_COUNT; i++)
     {
-        int16_t value = usb_read();
-        if (value < 0)
-            break;
+        state_mirror.leases[i] = leases[i];
+        state_mirror.lease_timeouts[i] = lease_timeouts[i];
+    }
 
-        // Enable the siren for 5 seconds
-        if (value == 0xFF)
-            enable_siren_steps = 10;
+    state_mirror.expired_leases = expired_leases;
+    state_mirror.triggered = triggered;
+    state_mirror.active = active;
+    state_mirror.shutter_a_close_steps = shutter_a_close_steps;
+    state_mirror.shutter_b_close_steps = shutter_b_close_steps;
+    state_mirror.relay_reset_steps = relay_reset_steps;
+    state_mirror.shutter_a_sent_steps = shutter_a_sent_steps;
+    state_mirror.shutter_b_sent_steps = shutter_b_sent_steps;
+    state_mirror.shutter_a_confirmed = shutter_a_confirmed;
+    state_mirror.shutter_b_confirmed = shutter_b_confirmed;
+    state_mirror_checksum = state_checksum(&state_mirror, sizeof(state_mirror));
+}
+
+// Write the held leases and trip state to EEPROM if they have changed
+// Called from the main loop because EEPROM writes are too slow for the ISR
+static void save_state(void)
+{
+    saved_state_t state;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (uint8_t i = 0; i < LEASE_COUNT; i++)
+            state.lease_timeouts[i] = leases[i] != 0 ? lease_timeouts[i] : 0;
+
+        state.triggered = triggered;
+        state.active = active;
+    }
+
+    state.checksum = state_checksum(&state, offsetof(saved_state_t, checksum));
+    if (memcmp(&state, &saved_state, sizeof(state)) == 0)
+        return;
 
-        // Accept timeouts up to two minutes
-        if (value > 240)
+    saved_state = state;
+    eeprom_update_block(&saved_state, &saved_state_eeprom, sizeof(saved_state));
+}
+
+// Close the dome by a step
+static void step_shutter_a(void)
+{
+    serial_write('A');
+    shutter_a_close_steps--;
+    shutter_a_sent_steps++;
+}
+
+static void step_shutter_b(void)
+{
+    serial_write('B');
+    shutter_b_close_steps--;
+    shutter_b_sent_steps++;
+}
+
+// Number of half-seconds until the lease policy triggers the force-close
+// 0 means that no leases are held and the heartbeat is disabled
+static uint8_t heartbeat_remaining(void)
+{
+    uint8_t remaining = 0;
+    for (uint8_t i = 0; i < LEASE_COUNT; i++)
+    {
+        uint8_t lease = leases[i];
+        if (lease == 0)
             continue;
 
-        // Clear the sticky trigger flag when disabling the heartbeat
-        // Also stops an active close
-        if (value == 0)
+#if LEASE_POLICY == LEASE_POLICY_ALL_EXPIRED
+        if (lease > remaining)
+            remaining = lease;
+#else
+        if (remaining == 0 || lease < remaining)
+            remaining = lease;
+#endif
+    }
+
+    return remaining;
+}
+
+// Status byte reported to the host: the heartbeat countdown (or 0 if disabled),
+// 254 while the dome is being closed, or 255 once the heartbeat has triggered
+static uint8_t current_status(void)
+{
+    return active ? 254 : triggered ? 255 : heartbeat_remaining();
+}
+
+#if FAST_CLOSE_INPUT
+// Start the debounce timer if the fast-close input is asserted while the heartbeat is armed
+// The timer1 compare B ISR closes the dome if the input is still asserted when it expires
+// Must only be called with interrupts disabled
+static void check_fast_close(void)
+{
+    if (heartbeat_remaining() == 0 || triggered || !FAST_CLOSE_ASSERTED)
+        return;
+
+    // Timer1 counts from 0 to OCR1A, so the compare may fall in the next period
+    uint16_t compare = TCNT1 + FAST_CLOSE_DEBOUNCE_CLOCKS;
+    if (compare > OCR1A)
+        compare -= OCR1A + 1;
+
+    OCR1B = compare;
+    TIFR1 = _BV(OCF1B);
+    TIMSK1 |= _BV(OCIE1B);
+}
+#endif
+
+// Update (or release, if timeout is 0) a single lease
+// If the heartbeat has triggered the status must be manually
+// cleared by sending a 0 byte before new leases are accepted
+static void update_lease(uint8_t lease, uint8_t timeout)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (triggered)
+            return;
+
+        // Only the timeout that a lease is taken with is saved to EEPROM,
+        // so that clients that vary their timeout don't wear it out
+        if (leases[lease] == 0)
+            lease_timeouts[lease] = timeout;
+
+        leases[lease] = timeout;
+        if (heartbeat_remaining() != 0)
+            HEARTBEAT_LED_ENABLED;
+        else
+            HEARTBEAT_LED_DISABLED;
+
+#if FAST_CLOSE_INPUT
+        // The input may have been asserted before the heartbeat was armed
+        check_fast_close();
+#endif
+
+        mirror_state();
+    }
+}
+
+// Switch the dome serial connection to the Arduino and start the close sequence
+// Must only be called with interrupts disabled
+static void start_close(void)
+{
+    shutter_a_close_steps = close_step_budget(shutter_a_learned_steps);
+    shutter_b_close_steps = close_step_budget(shutter_b_learned_steps);
+    shutter_a_sent_steps = shutter_b_sent_steps = 0;
+    shutter_a_confirmed = shutter_b_confirmed = false;
+
+    HEARTBEAT_LED_TRIGGERED;
+    triggered = true;
+    active = true;
+    RELAY_ENABLED;
+
+    #if HAS_BUMPER_GUARD
+    // Spend a couple of seconds trying to toggle
+    // the bumper guard relay before sending close commands
+    relay_reset_steps = 4;
+    #endif
+}
+
+// Release the leases and close the dome
+// Must only be called from inside an ISR
+static void trip(void)
+{
+    stats_increment(STATS_TRIPS);
+
+    for (uint8_t i = 0; i < LEASE_COUNT; i++)
+        leases[i] = 0;
+
+    start_close();
+
+    // Anything already received was sent before the close started and
+    // can't be trusted, and in bridge mode the PC may have queued commands
+    serial_discard_input();
+    serial_discard_output();
+
+    mirror_state();
+}
+
+// Resume the heartbeat after a reset: exactly from the mirror if it survived, or otherwise
+// by restarting the saved leases (with their full timeouts), sticky trip state, or close
+// Called before the USB and serial ports are started, so protection resumes immediately
+static void restore_state(void)
+{
+    eeprom_read_block(&saved_state, &saved_state_eeprom, sizeof(saved_state));
+
+    if (state_mirror_checksum == state_checksum(&state_mirror, sizeof(state_mirror)))
+    {
+        for (uint8_t i = 0; i < LEASE_COUNT; i++)
         {
-            triggered = false;
-            active = false;
-            RELAY_DISABLED;
+            leases[i] = state_mirror.leases[i];
+            lease_timeouts[i] = state_mirror.lease_timeouts[i];
         }
 
-        // Update the heartbeat countdown (disabling it if 0)
-        // If the heatbeat has triggered the status must be manually
-        // cleared by sending a 0 byte
-        if (!triggered)
+        expired_leases = state_mirror.expired_leases;
+        triggered = state_mirror.triggered;
+        active = state_mirror.active;
+        shutter_a_close_steps = state_mirror.shutter_a_close_steps;
+        shutter_b_close_steps = state_mirror.shutter_b_close_steps;
+        relay_reset_steps = state_mirror.relay_reset_steps;
+        shutter_a_sent_steps = state_mirror.shutter_a_sent_steps;
+        shutter_b_sent_steps = state_mirror.shutter_b_sent_steps;
+        shutter_a_confirmed = state_mirror.shutter_a_confirmed;
+        shutter_b_confirmed = state_mirror.shutter_b_confirmed;
+    }
+    else if (saved_state.checksum == state_checksum(&saved_state, offsetof(saved_state_t, checksum)))
+    {
+        // The trip was already counted before the reset, and the
+        // serial port is started (with empty buffers) after this
+        if (saved_state.active)
+            start_close();
+        else if (saved_state.triggered)
+            triggered = true;
+        else
+        {
+            for (uint8_t i = 0; i < LEASE_COUNT; i++)
+            {
+                uint8_t timeout = saved_state.lease_timeouts[i];
+                leases[i] = lease_timeouts[i] = timeout <= 240 ? timeout : 0;
+            }
+        }
+    }
+
+    if (active)
+    {
+        RELAY_ENABLED;
+
+        // Send the next close command as soon as interrupts are enabled
+        TCNT1 = OCR1A - 2;
+    }
+
+    if (triggered)
+        HEARTBEAT_LED_TRIGGERED;
+    else if (heartbeat_remaining() != 0)
+        HEARTBEAT_LED_ENABLED;
+
+#if FAST_CLOSE_INPUT
+    check_fast_close();
+#endif
+
+    mirror_state();
+}
+
+// Handle a byte received from the host PC
+static void handle_usb_byte(uint8_t value)
+{
+    sniffer_record_host(SNIFFER_FROM_PC, value);
+    pending_command_ticks = 0;
+
+    if (pending_command != 0)
+    {
+        pending_args[pending_arg_count++] = value;
+        if (pending_arg_count < pending_arg_length)
+            return;
+
+        // Lease ids and timeouts outside the valid range are ignored
+        if (pending_command == CMD_PING_LEASE && pending_args[0] < LEASE_COUNT && pending_args[1] <= 240)
+            update_lease(pending_args[0], pending_args[1]);
+
+        if (pending_command == CMD_SNIFFER)
+            sniffer_enable(pending_args[0] != 0);
+
+#if TWI_BUS
+        // Invalid reads and reads made before the last has completed are ignored
+        if (pending_command == CMD_TWI_READ && pending_args[0] < 0x80 &&
+            pending_args[2] > 0 && pending_args[2] <= TWI_READ_MAX && twi_read.status != TWI_PENDING)
+        {
+            twi_read.address = pending_args[0];
+            twi_read.read_length = pending_args[2];
+            twi_read_register = pending_args[1];
+            twi_submit(&twi_read);
+        }
+#endif
+
+        pending_command = 0;
+        return;
+    }
+
+    // Enable the siren for 5 seconds
+    if (value == 0xFF)
+        enable_siren_steps = 10;
+
+    if (value == CMD_REPORT_CALIBRATION)
+    {
+        uint8_t report[] = { CMD_REPORT_CALIBRATION, shutter_a_learned_steps, shutter_b_learned_steps };
+        usb_write_data(report, sizeof(report));
+        return;
+    }
+
+    if (value == CMD_RESET_CALIBRATION)
+    {
+        shutter_a_learned_steps = 0;
+        shutter_b_learned_steps = 0;
+        calibration_changed = true;
+        return;
+    }
+
+    if (value == CMD_PING_LEASE)
+    {
+        pending_command = CMD_PING_LEASE;
+        pending_arg_count = 0;
+        pending_arg_length = 2;
+        return;
+    }
+
+    if (value == CMD_REPORT_MEMORY)
+    {
+        uint16_t static_usage = memory_static_usage();
+        uint16_t stack_usage = memory_stack_usage();
+        uint16_t never_used = memory_never_used();
+        uint8_t report[] =
         {
-            heartbeat = value;
-            if (heartbeat != 0)
-                HEARTBEAT_LED_ENABLED;
-            else
-                HEARTBEAT_LED_DISABLED;
+            CMD_REPORT_MEMORY,
+            static_usage & 0xFF, static_usage >> 8,
+            stack_usage & 0xFF, stack_usage >> 8,
+            never_used & 0xFF, never_used >> 8
+        };
+
+        usb_write_data(report, sizeof(report));
+        return;
+    }
+
+    if (value == CMD_REPORT_STATS)
+    {
+        uint8_t report[2 + STATS_COUNT * 4] = { CMD_REPORT_STATS, STATS_COUNT };
+        stats_snapshot(report + 2);
+        usb_write_data(report, sizeof(report));
+        return;
+    }
+
+#if PROFILE
+    if (value == CMD_REPORT_PROFILE)
+    {
+        profile_report();
+        return;
+    }
+#endif
+
+#if ADC_TELEMETRY
+    if (value == CMD_REPORT_ADC)
+    {
+        adc_report();
+        return;
+    }
+#endif
+
+#if TWI_BUS
+    if (value == CMD_TWI_READ)
+    {
+        pending_command = CMD_TWI_READ;
+        pending_arg_count = 0;
+        pending_arg_length = 3;
+        return;
+    }
+#endif
+
+    if (value == CMD_SNIFFER)
+    {
+        pending_command = CMD_SNIFFER;
+        pending_arg_count = 0;
+        pending_arg_length = 1;
+        return;
+    }
+
+    if (value == CMD_REPORT_LEASES)
+    {
+        uint8_t report[2 + LEASE_COUNT] = { CMD_REPORT_LEASES, expired_leases };
+        for (uint8_t i = 0; i < LEASE_COUNT; i++)
+            report[2 + i] = leases[i];
+
+        usb_write_data(report, sizeof(report));
+        return;
+    }
+
+    // Accept timeouts up to two minutes
+    if (value > 240)
+        return;
+
+    // Clear the sticky trigger flag when disabling the heartbeat
+    // Also stops an active close
+    if (value == 0)
+    {
+        if (triggered)
+            stats_increment(STATS_TRIP_RESETS);
+
+        triggered = false;
+        active = false;
+        expired_leases = 0;
+        RELAY_IDLE;
+    }
+
+    // Update the heartbeat countdown (disabling it if 0)
+    update_lease(0, value);
+}
+
+void poll_usb(void)
+{
+    // Discard a partly received command if the host has opened or closed the port
+    // or stopped sending, so that the next client's pings, 0 or siren bytes aren't
+    // taken as its arguments
+    if (usb_line_state_changed() || pending_command_ticks > 1)
+        pending_command = 0;
+
+    // Check for ping or disable bytes from the host PC
+    // Each packet is read in one go to avoid reselecting the endpoint for every byte
+    uint8_t buffer[CDC_PACKET_SIZE];
+    uint8_t length;
+    while ((length = usb_read_data(buffer, sizeof(buffer))) > 0)
+        for (uint8_t i = 0; i < length; i++)
+            handle_usb_byte(buffer[i]);
+
+#if TWI_BUS
+    if (twi_read_finished)
+    {
+        twi_read_finished = false;
+
+        uint8_t report[3 + TWI_READ_MAX] = { CMD_TWI_READ, twi_read.status };
+        uint8_t length = 3;
+        if (twi_read.status == TWI_COMPLETE)
+        {
+            report[2] = twi_read.read_length;
+            for (uint8_t i = 0; i < twi_read.read_length; i++)
+                report[length++] = twi_read_buffer[i];
         }
+
+        usb_write_data(report, length);
     }
+#endif
+
+    if (calibration_changed)
+        save_calibration();
+
+    save_state();
+
+    // Send any sniffed records, including partial batches once per status byte
+    sniffer_poll(send_status_byte);
 
     if (send_status_byte)
     {
         // Send current status back to the host computer
-        usb_write(active ? 254 : triggered ? 255 : heartbeat);
+        // Only statuses that reached the host are recorded
+        uint8_t status = current_status();
+        if (usb_write(status))
+            sniffer_record_host(SNIFFER_TO_PC, status);
         send_status_byte = false;
     }
 }
 
+#if BRIDGE_MODE
+// Forward bytes between the PC and the dome through the bridge port
+void poll_bridge(void)
+{
+    uint8_t buffer[CDC_PACKET_SIZE];
+    for (;;)
+    {
+        uint8_t space = serial_write_space();
+        if (space <= BRIDGE_SERIAL_RESERVE)
+            break;
+
+        space -= BRIDGE_SERIAL_RESERVE;
+        uint8_t length = usb_bridge_read_data(buffer, space < sizeof(buffer) ? space : sizeof(buffer));
+        if (length == 0)
+            break;
+
+        // The PC loses control of the dome while it is being closed
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if (!active)
+                for (uint8_t i = 0; i < length; i++)
+                    serial_write(buffer[i]);
+        }
+    }
+
+    // Send at most one packet per call to keep the heartbeat handling responsive
+    uint8_t length = serial_bridge_read(buffer, sizeof(buffer));
+    if (length > 0)
+        usb_bridge_write_data(buffer, length);
+}
+#endif
+
+#if NETWORK
+// Answer status and heartbeat datagrams from the network
+// and announce state changes to the multicast group
+void poll_network(void)
+{
+    uint8_t request[3];
+    int16_t length = network_receive(request, sizeof(request));
+    if (length >= 0)
+    {
+        // Lease ids and timeouts outside the valid range are ignored
+        if (length == 3 && request[0] == CMD_PING_LEASE && request[1] < LEASE_COUNT && request[2] <= 240)
+            update_lease(request[1], request[2]);
+
+        // Every datagram is answered with the current status
+        uint8_t status = current_status();
+        network_reply(&status, 1);
+    }
+
+    uint8_t status = current_status();
+    uint8_t state = status > 0 && status <= 240 ? 1 : status;
+    if (state != network_state)
+    {
+        network_state = state;
+        network_announce(&status, 1);
+    }
+}
+#endif
+
 int main(void)
 {
     // Configure timer1 to interrupt every 0.50 seconds
@@ -114,26 +785,51 @@ int main(void)
 
     RELAY_INIT;
     SIREN_INIT;
-    BLINKER_LED_INIT;
     HEARTBEAT_LED_INIT;
+#if FAST_CLOSE_INPUT
+    FAST_CLOSE_INIT;
+#endif
 
+    load_calibration();
+    restore_state();
+    indicator_initialize();
+#if PROFILE
+    profile_initialize();
+#endif
+#if TWI_BUS
+    twi_initialize();
+#endif
+#if ADC_TELEMETRY
+    adc_initialize();
+#endif
+#if MASS_STORAGE
+    storage_initialize();
+#endif
     usb_initialize();
     serial_initialize();
 
     sei();
     for (;;)
+    {
         poll_usb();
+#if BRIDGE_MODE
+        poll_bridge();
+#endif
+#if MASS_STORAGE
+        usb_storage_poll();
+#endif
+#if NETWORK
+        usb_network_poll();
+        poll_network();
+#endif
+    }
 }
 
-volatile bool led_active;
 ISR(TIMER1_COMPA_vect)
 {
-    // Update the status LED on the arduino to show that the
-    // monitoring is still active
-    if ((led_active ^= true))
-        BLINKER_LED_ENABLED;
-    else
-        BLINKER_LED_DISABLED;
+    // Count the tick before anything is sniffed, so that the dome bytes
+    // sent and received below are stamped with the tick they belong to
+    sniffer_tick();
 
     // Check whether we need to close the dome
     // This is done inside the ISR to avoid any problems with the USB connection blocking
@@ -151,81 +847,158 @@ ISR(TIMER1_COMPA_vect)
         {
             case 'X': // 'A' shutter closed
                 shutter_a_close_steps = 0;
+                shutter_a_confirmed = true;
                 break;
             case 'Y': // 'B' shutter closed
                 shutter_b_close_steps = 0;
+                shutter_b_confirmed = true;
                 break;
             case '0': // 'A' shutter closed, 'B' shutter closed (PLC dome controller only)
                 shutter_a_close_steps = 0;
                 shutter_b_close_steps = 0;
+                shutter_a_confirmed = true;
+                shutter_b_confirmed = true;
         }
     }
 
-    // Decrement the heartbeat counter and trigger a close if it reaches 0
-    // There are two special values that are not real times:
-    //   0xFF represents that the heartbeat has been tripped, and is sticky until the heartbeat is disabled
-    //   0x00 represents that the heartbeat is disabled
-    if (heartbeat != 0xFF && heartbeat != 0)
+    // Learn how many steps each shutter needed before it reported closed
+    if (active)
     {
-        // Start the siren 5 seconds before closing
-        // There is a chance that we may receive another
-        // ping, but its much more likely that we will close
-        if (heartbeat == 10)
-            enable_siren_steps = 10;
+        if (shutter_a_confirmed)
+            shutter_a_learned_steps = learn_close_steps(shutter_a_learned_steps, shutter_a_sent_steps);
+        if (shutter_b_confirmed)
+            shutter_b_learned_steps = learn_close_steps(shutter_b_learned_steps, shutter_b_sent_steps);
+    }
 
-        if (--heartbeat == 0)
+    // Decrement the held leases and trigger a close when the lease policy says so
+    // Leases with a value of 0 are not held (or have been tripped, which
+    // is sticky until the heartbeat is disabled)
+    //
+    // Start the siren 5 seconds before closing
+    // There is a chance that we may receive another
+    // ping, but its much more likely that we will close
+    if (heartbeat_remaining() == 10)
+        enable_siren_steps = 10;
+
+#if LEASE_POLICY == LEASE_POLICY_ALL_EXPIRED
+    bool lease_held = false;
+#endif
+    bool lease_expired = false;
+    for (uint8_t i = 0; i < LEASE_COUNT; i++)
+    {
+        if (leases[i] == 0)
+            continue;
+
+        if (--leases[i] == 0)
         {
-            shutter_a_close_steps = MAX_SHUTTER_CLOSE_STEPS;
-            shutter_b_close_steps = MAX_SHUTTER_CLOSE_STEPS;
+            expired_leases |= _BV(i);
+            lease_expired = true;
+        }
+#if LEASE_POLICY == LEASE_POLICY_ALL_EXPIRED
+        else
+            lease_held = true;
+#endif
+    }
 
-            HEARTBEAT_LED_TRIGGERED;
-            triggered = true;
-            active = true;
-            RELAY_ENABLED;
-
-            #if HAS_BUMPER_GUARD
-            // Spend a couple of seconds trying to toggle
-            // the bumper guard relay before sending close commands
-            relay_reset_steps = 4;
-            #endif
+#if LEASE_POLICY == LEASE_POLICY_ALL_EXPIRED
+    if (lease_expired && !lease_held)
+        trip();
+#else
+    if (lease_expired)
+        trip();
+#endif
+
+#if FAST_CLOSE_INPUT
+    // The input only triggers on an edge, so also check its level in case
+    // it was asserted while the heartbeat was disabled or expiring
+    check_fast_close();
+#endif
+
+#if LOW_VOLTAGE_TRIP_MV
+    // Close the dome while there is still enough power to do so
+    // This only applies while the heartbeat is armed, like the fast-close input
+    uint16_t supply = adc_millivolts(ADC_SUPPLY);
+    if (supply != ADC_NO_READING && supply < LOW_VOLTAGE_TRIP_MV && heartbeat_remaining() != 0 && !triggered)
+    {
+        if (++low_voltage_ticks >= LOW_VOLTAGE_TRIP_TICKS)
+        {
+            trip();
+            enable_siren_steps = 10;
         }
     }
+    else
+        low_voltage_ticks = 0;
+#endif
 
     if (relay_reset_steps > 0)
     {
         serial_write('R');
         relay_reset_steps--;
     }
-#if CLOSE_B_FIRST
-    else if (shutter_b_close_steps > 0)
+#if CLOSE_INTERLEAVED
+    else
     {
-        // Close the dome by a step
-        serial_write('B');
-        shutter_b_close_steps--;
+        // Step both shutters together
+        // Each stops independently once it reports closed
+#if CLOSE_B_FIRST
+        if (shutter_b_close_steps > 0)
+            step_shutter_b();
+        if (shutter_a_close_steps > 0)
+            step_shutter_a();
+#else
+        if (shutter_a_close_steps > 0)
+            step_shutter_a();
+        if (shutter_b_close_steps > 0)
+            step_shutter_b();
+#endif
     }
+#elif CLOSE_B_FIRST
+    else if (shutter_b_close_steps > 0)
+        step_shutter_b();
     else if (shutter_a_close_steps > 0)
-    {
-        serial_write('A');
-        shutter_a_close_steps--;
-    }
+        step_shutter_a();
 #else
     else if (shutter_a_close_steps > 0)
+        step_shutter_a();
+    else if (shutter_b_close_steps > 0)
+        step_shutter_b();
+#endif
+
+    // A shutter that has used its learned budget without reporting closed (e.g. because
+    // it has slowed down or a reply was lost) may need more steps than we have learned,
+    // so keep stepping it up to the full MAX_SHUTTER_CLOSE_STEPS in this close and go
+    // back to budgeting the maximum until it has been learned again
+    if (active && shutter_a_close_steps == 0 && !shutter_a_confirmed)
     {
-        serial_write('A');
-        shutter_a_close_steps--;
+        if (shutter_a_sent_steps < MAX_SHUTTER_CLOSE_STEPS)
+            shutter_a_close_steps = MAX_SHUTTER_CLOSE_STEPS - shutter_a_sent_steps;
+
+        if (shutter_a_learned_steps != 0)
+        {
+            shutter_a_learned_steps = 0;
+            calibration_changed = true;
+        }
     }
-    else if (shutter_b_close_steps > 0)
+
+    if (active && shutter_b_close_steps == 0 && !shutter_b_confirmed)
     {
-        serial_write('B');
-        shutter_b_close_steps--;
+        if (shutter_b_sent_steps < MAX_SHUTTER_CLOSE_STEPS)
+            shutter_b_close_steps = MAX_SHUTTER_CLOSE_STEPS - shutter_b_sent_steps;
+
+        if (shutter_b_learned_steps != 0)
+        {
+            shutter_b_learned_steps = 0;
+            calibration_changed = true;
+        }
     }
-#endif
 
     // Return serial control to the PC after both shutters are closed
+    // (or have been sent MAX_SHUTTER_CLOSE_STEPS without reporting closed)
     if (active && shutter_a_close_steps == 0 && shutter_b_close_steps == 0)
     {
-        RELAY_DISABLED;
+        RELAY_IDLE;
         active = false;
+        stats_increment(STATS_CLOSES);
     }
 
     if (enable_siren_steps > 0)
@@ -236,5 +1009,53 @@ ISR(TIMER1_COMPA_vect)
             SIREN_DISABLED;
     }
 
+    // Update the status LED on the arduino to show what the monitor is doing
+    // The LED is blinked by timer4, so this only does work when the state changes
+    uint8_t remaining = heartbeat_remaining();
+    if (active)
+        indicator_set_pattern(INDICATOR_CLOSING);
+    else if (triggered)
+        indicator_set_pattern(INDICATOR_TRIPPED);
+    else if (remaining != 0 && remaining <= 10)
+        indicator_set_pattern(INDICATOR_WARNING);
+    else if (remaining != 0)
+        indicator_set_pattern(INDICATOR_ARMED);
+    else
+        indicator_set_pattern(INDICATOR_DISABLED);
+
+    if (pending_command_ticks < 0xFF)
+        pending_command_ticks++;
+
+#if TWI_BUS
+    twi_tick();
+#endif
+    mirror_state();
     send_status_byte = true;
 }
+
+#if FAST_CLOSE_INPUT
+ISR(PCINT0_vect)
+{
+    // Every edge restarts the debounce timer, so a
+    // bouncing input is only checked once it has settled
+    check_fast_close();
+}
+
+ISR(TIMER1_COMPB_vect)
+{
+    TIMSK1 &= ~_BV(OCIE1B);
+
+    // The input only closes the dome while the heartbeat is armed,
+    // and is handled the same way as the heartbeat expiring
+    if (heartbeat_remaining() == 0 || triggered || !FAST_CLOSE_ASSERTED)
+        return;
+
+    trip();
+    enable_siren_steps = 10;
+
+    // Bring the next timer1 tick forward so that the first command is sent
+    // now instead of up to 0.5 seconds later. Writing TCNT1 blocks a compare
+    // match on the next timer clock, so the match is set two clocks ahead.
+    TCNT1 = OCR1A - 2;
+}
+#endif
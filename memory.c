@@ -0,0 +1,68 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#include <avr/io.h>
+#include <stdint.h>
+#include "memory.h"
+
+// Value written to the unused RAM at boot
+// Any byte that no longer holds this value has been used by the stack
+#define STACK_CANARY 0xC5
+#define STRINGIFY(x) #x
+#define STRINGIFY_VALUE(x) STRINGIFY(x)
+
+// Symbols provided by the linker
+// .data, .bss and .noinit occupy the RAM from __data_start to _end,
+// and the stack grows down from __stack towards _end
+extern uint8_t __data_start;
+extern uint8_t _end;
+extern uint8_t __stack;
+
+void memory_paint(void) __attribute__((naked, used, section(".init1")));
+
+// Fill the RAM between the static variables and the top of the stack with the canary
+// This runs before the C runtime has been initialized (r1 hasn't been
+// cleared and .data/.bss haven't been set up), so it must be written in assembly
+void memory_paint(void)
+{
+    __asm__ volatile (
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, " STRINGIFY_VALUE(STACK_CANARY) "\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n");
+}
+
+// Number of bytes used by .data, .bss and .noinit
+uint16_t memory_static_usage(void)
+{
+    return &_end - &__data_start;
+}
+
+// Number of bytes between the static variables and the deepest stack
+// position that has been reached since boot
+uint16_t memory_never_used(void)
+{
+    // The canary can be coincidentally written by the stack, so this
+    // may slightly overestimate the free space for a very full stack
+    const uint8_t *p = &_end;
+    while (p <= &__stack && *p == STACK_CANARY)
+        p++;
+
+    return p - &_end;
+}
+
+// Largest number of bytes that the stack has used since boot
+uint16_t memory_stack_usage(void)
+{
+    return (&__stack - &_end + 1) - memory_never_used();
+}
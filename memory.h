@@ -0,0 +1,17 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#include <stdint.h>
+
+#ifndef DOME_HEARTBEAT_MEMORY_H
+#define DOME_HEARTBEAT_MEMORY_H
+
+uint16_t memory_static_usage(void);
+uint16_t memory_stack_usage(void);
+uint16_t memory_never_used(void);
+
+#endif
@@ -0,0 +1,288 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#if NETWORK
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "network.h"
+#include "usb.h"
+
+// Minimal IPv4 stack for the RNDIS network interface: ARP requests and pings for the
+// monitor's address are answered here, and UDP datagrams sent to NETWORK_UDP_PORT are
+// passed up to the main loop. Everything else is dropped.
+
+// Frames larger than this are dropped, which still leaves space for the
+// status datagrams and for pings with up to 82 bytes of data
+#define NETWORK_FRAME_SIZE 128
+
+// Ethernet frames shorter than this are padded with zeros
+#define ETHERNET_MIN_FRAME 60
+
+// Each frame is sent to the host after a 44 byte RNDIS header in 64 byte USB packets
+// LUFA doesn't end a transfer that fills the last packet with a zero length packet,
+// so those frames are padded by a byte to make the last packet short instead
+#define RNDIS_HEADER_SIZE  44
+#define RNDIS_PACKET_SIZE  64
+
+// Byte offsets of the header fields within a frame
+#define ETH_DEST           0
+#define ETH_SOURCE         6
+#define ETH_TYPE           12
+#define ETH_HEADER         14
+
+#define ETH_TYPE_IPV4      0x0800
+#define ETH_TYPE_ARP       0x0806
+
+#define ARP_HARDWARE       (ETH_HEADER + 0)
+#define ARP_PROTOCOL       (ETH_HEADER + 2)
+#define ARP_OPERATION      (ETH_HEADER + 6)
+#define ARP_SENDER_MAC     (ETH_HEADER + 8)
+#define ARP_SENDER_IP      (ETH_HEADER + 14)
+#define ARP_TARGET_MAC     (ETH_HEADER + 18)
+#define ARP_TARGET_IP      (ETH_HEADER + 24)
+#define ARP_END            (ETH_HEADER + 28)
+
+#define ARP_ETHERNET       1
+#define ARP_REQUEST        1
+#define ARP_REPLY          2
+
+#define IP_VERSION         (ETH_HEADER + 0)
+#define IP_TOTAL_LENGTH    (ETH_HEADER + 2)
+#define IP_ID              (ETH_HEADER + 4)
+#define IP_FRAGMENT        (ETH_HEADER + 6)
+#define IP_TTL             (ETH_HEADER + 8)
+#define IP_PROTOCOL        (ETH_HEADER + 9)
+#define IP_CHECKSUM        (ETH_HEADER + 10)
+#define IP_SOURCE          (ETH_HEADER + 12)
+#define IP_DEST            (ETH_HEADER + 16)
+#define IP_HEADER          (ETH_HEADER + 20)
+
+// Version 4 with a 20 byte header (i.e. no options)
+#define IP_VERSION_4       0x45
+#define IP_DONT_FRAGMENT   0x4000
+#define IP_FRAGMENT_MASK   0x3FFF
+#define IP_PROTOCOL_ICMP   1
+#define IP_PROTOCOL_UDP    17
+
+#define ICMP_TYPE          (IP_HEADER + 0)
+#define ICMP_CHECKSUM      (IP_HEADER + 2)
+#define ICMP_HEADER        8
+
+#define ICMP_ECHO_REPLY    0
+#define ICMP_ECHO_REQUEST  8
+
+#define UDP_SOURCE_PORT    (IP_HEADER + 0)
+#define UDP_DEST_PORT      (IP_HEADER + 2)
+#define UDP_LENGTH         (IP_HEADER + 4)
+#define UDP_CHECKSUM       (IP_HEADER + 6)
+#define UDP_DATA           (IP_HEADER + 8)
+
+// Largest datagram payload that can be sent from the frame buffer
+// (leaving space for the RNDIS padding byte)
+#define UDP_DATA_MAX       (NETWORK_FRAME_SIZE - UDP_DATA - 1)
+
+// Hop limits for replies and for the state change announcements, which stay on the USB link
+#define REPLY_TTL          64
+#define ANNOUNCE_TTL       1
+
+// The host's end of the link (usb.c) uses 02:00:00:00:4D:02
+static const uint8_t local_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x4D, 0x01 };
+
+// Link-local address, so that a host using IPv4 link-local (zeroconf) addressing
+// can reach the monitor without any other configuration
+static const uint8_t local_ip[4] = { 169, 254, 77, 1 };
+
+// The state change announcements are sent to the multicast group 239.255.77.1
+static const uint8_t group_mac[6] = { 0x01, 0x00, 0x5E, 0x7F, 0x4D, 0x01 };
+static const uint8_t group_ip[4] = { 239, 255, 77, 1 };
+
+static uint8_t frame[NETWORK_FRAME_SIZE];
+
+// Sender of the last datagram, for network_reply
+static uint8_t reply_mac[6];
+static uint8_t reply_ip[4];
+static uint16_t reply_port;
+
+static uint16_t ip_id = 0;
+
+static uint16_t read_word(uint8_t offset)
+{
+    return ((uint16_t)frame[offset] << 8) | frame[offset + 1];
+}
+
+static void write_word(uint8_t offset, uint16_t value)
+{
+    frame[offset] = value >> 8;
+    frame[offset + 1] = value & 0xFF;
+}
+
+// Internet checksum of length bytes of the frame starting at offset
+// A header with a valid checksum field sums to zero
+static uint16_t checksum(uint8_t offset, uint8_t length)
+{
+    uint32_t sum = 0;
+    for (uint8_t i = 0; i < length; i += 2)
+        sum += ((uint16_t)frame[offset + i] << 8) | (i + 1 < length ? frame[offset + i + 1] : 0);
+
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return ~sum;
+}
+
+static void update_ip_checksum(void)
+{
+    write_word(IP_CHECKSUM, 0);
+    write_word(IP_CHECKSUM, checksum(ETH_HEADER, IP_HEADER - ETH_HEADER));
+}
+
+static void send_frame(uint8_t length)
+{
+    while (length < ETHERNET_MIN_FRAME)
+        frame[length++] = 0;
+
+    // The IP length field tells the receiver to ignore the extra byte
+    if ((RNDIS_HEADER_SIZE + length) % RNDIS_PACKET_SIZE == 0)
+        frame[length++] = 0;
+
+    usb_network_write(frame, length);
+}
+
+static void send_datagram(const uint8_t *mac, const uint8_t *ip, uint16_t port, uint8_t ttl, const uint8_t *data, uint8_t length)
+{
+    if (length > UDP_DATA_MAX)
+        length = UDP_DATA_MAX;
+
+    memcpy(frame + ETH_DEST, mac, 6);
+    memcpy(frame + ETH_SOURCE, local_mac, 6);
+    write_word(ETH_TYPE, ETH_TYPE_IPV4);
+
+    frame[IP_VERSION] = IP_VERSION_4;
+    frame[IP_VERSION + 1] = 0;
+    write_word(IP_TOTAL_LENGTH, UDP_DATA - ETH_HEADER + length);
+    write_word(IP_ID, ip_id++);
+    write_word(IP_FRAGMENT, IP_DONT_FRAGMENT);
+    frame[IP_TTL] = ttl;
+    frame[IP_PROTOCOL] = IP_PROTOCOL_UDP;
+    memcpy(frame + IP_SOURCE, local_ip, 4);
+    memcpy(frame + IP_DEST, ip, 4);
+    update_ip_checksum();
+
+    // The UDP checksum is optional for IPv4, and the USB link has its own CRC
+    write_word(UDP_SOURCE_PORT, NETWORK_UDP_PORT);
+    write_word(UDP_DEST_PORT, port);
+    write_word(UDP_LENGTH, UDP_DATA - IP_HEADER + length);
+    write_word(UDP_CHECKSUM, 0);
+    memcpy(frame + UDP_DATA, data, length);
+
+    send_frame(UDP_DATA + length);
+}
+
+// Answer ARP requests for the monitor's address
+static void handle_arp(uint8_t length)
+{
+    if (length < ARP_END || read_word(ARP_HARDWARE) != ARP_ETHERNET || read_word(ARP_PROTOCOL) != ETH_TYPE_IPV4 ||
+        read_word(ARP_OPERATION) != ARP_REQUEST || memcmp(frame + ARP_TARGET_IP, local_ip, 4) != 0)
+        return;
+
+    write_word(ARP_OPERATION, ARP_REPLY);
+    memcpy(frame + ARP_TARGET_MAC, frame + ARP_SENDER_MAC, 10);
+    memcpy(frame + ARP_SENDER_MAC, local_mac, 6);
+    memcpy(frame + ARP_SENDER_IP, local_ip, 4);
+    memcpy(frame + ETH_DEST, frame + ARP_TARGET_MAC, 6);
+    memcpy(frame + ETH_SOURCE, local_mac, 6);
+    send_frame(ARP_END);
+}
+
+// Answer pings by sending the received packet back with its addresses swapped
+static void handle_icmp(uint8_t length)
+{
+    if (length < ICMP_HEADER || frame[ICMP_TYPE] != ICMP_ECHO_REQUEST)
+        return;
+
+    frame[ICMP_TYPE] = ICMP_ECHO_REPLY;
+    write_word(ICMP_CHECKSUM, 0);
+    write_word(ICMP_CHECKSUM, checksum(IP_HEADER, length));
+
+    memcpy(frame + ETH_DEST, frame + ETH_SOURCE, 6);
+    memcpy(frame + ETH_SOURCE, local_mac, 6);
+    memcpy(frame + IP_DEST, frame + IP_SOURCE, 4);
+    memcpy(frame + IP_SOURCE, local_ip, 4);
+    frame[IP_TTL] = REPLY_TTL;
+    update_ip_checksum();
+
+    send_frame(IP_HEADER + length);
+}
+
+// Handle the next frame from the host, if there is one
+// Copies up to length bytes of a datagram sent to NETWORK_UDP_PORT into data
+// Returns the number of bytes copied, or -1 if no datagram was received
+int16_t network_receive(uint8_t *data, uint8_t length)
+{
+    uint8_t size = usb_network_read(frame, NETWORK_FRAME_SIZE);
+    if (size < ETH_HEADER)
+        return -1;
+
+    if (read_word(ETH_TYPE) == ETH_TYPE_ARP)
+    {
+        handle_arp(size);
+        return -1;
+    }
+
+    // Only accept unfragmented packets without options that are addressed to the monitor
+    if (read_word(ETH_TYPE) != ETH_TYPE_IPV4 || size < IP_HEADER || frame[IP_VERSION] != IP_VERSION_4 ||
+        (read_word(IP_FRAGMENT) & IP_FRAGMENT_MASK) || memcmp(frame + IP_DEST, local_ip, 4) != 0 ||
+        checksum(ETH_HEADER, IP_HEADER - ETH_HEADER) != 0)
+        return -1;
+
+    // Frames may be padded beyond the end of the packet
+    uint16_t total_length = read_word(IP_TOTAL_LENGTH);
+    if (total_length < IP_HEADER - ETH_HEADER || total_length > size - ETH_HEADER)
+        return -1;
+
+    uint8_t ip_data_length = total_length - (IP_HEADER - ETH_HEADER);
+    if (frame[IP_PROTOCOL] == IP_PROTOCOL_ICMP)
+    {
+        handle_icmp(ip_data_length);
+        return -1;
+    }
+
+    if (frame[IP_PROTOCOL] != IP_PROTOCOL_UDP || ip_data_length < UDP_DATA - IP_HEADER ||
+        read_word(UDP_DEST_PORT) != NETWORK_UDP_PORT)
+        return -1;
+
+    uint16_t udp_length = read_word(UDP_LENGTH);
+    if (udp_length < UDP_DATA - IP_HEADER || udp_length > ip_data_length)
+        return -1;
+
+    memcpy(reply_mac, frame + ETH_SOURCE, 6);
+    memcpy(reply_ip, frame + IP_SOURCE, 4);
+    reply_port = read_word(UDP_SOURCE_PORT);
+
+    uint8_t data_length = udp_length - (UDP_DATA - IP_HEADER);
+    if (data_length > length)
+        data_length = length;
+
+    memcpy(data, frame + UDP_DATA, data_length);
+    return data_length;
+}
+
+// Send a datagram back to the sender of the last datagram returned by network_receive
+void network_reply(const uint8_t *data, uint8_t length)
+{
+    send_datagram(reply_mac, reply_ip, reply_port, REPLY_TTL, data, length);
+}
+
+// Send a datagram to everyone listening on the multicast group
+void network_announce(const uint8_t *data, uint8_t length)
+{
+    send_datagram(group_mac, group_ip, NETWORK_UDP_PORT, ANNOUNCE_TTL, data, length);
+}
+
+#endif
@@ -0,0 +1,20 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#include <stdint.h>
+
+#ifndef DOME_HEARTBEAT_NETWORK_H
+#define DOME_HEARTBEAT_NETWORK_H
+
+// UDP port for status and heartbeat datagrams, and for the state change announcements
+#define NETWORK_UDP_PORT 7777
+
+int16_t network_receive(uint8_t *data, uint8_t length);
+void network_reply(const uint8_t *data, uint8_t length);
+void network_announce(const uint8_t *data, uint8_t length);
+
+#endif
@@ -0,0 +1,109 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#if PROFILE
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <util/atomic.h>
+#include "profile.h"
+#include "protocol.h"
+#include "usb.h"
+
+// Number of times that the interrupted program counter fell inside each bucket
+static uint16_t histogram[PROFILE_BUCKETS];
+
+void profile_initialize(void)
+{
+    // Configure timer0 to interrupt every 0.000996 seconds
+    // This is deliberately not a multiple of the 1ms USB frame so that the
+    // samples don't lock onto the same point in the frame handling
+    OCR0A = 248;
+    TCCR0A = _BV(WGM01);
+    TCCR0B = _BV(CS01) | _BV(CS00);
+    TIMSK0 |= _BV(OCIE0A);
+}
+
+// Send the histogram to the host: CMD, bucket shift, bucket count, then
+// each bucket as a little-endian 16 bit word. The histogram is then cleared.
+void profile_report(void)
+{
+    uint8_t header[] = { CMD_REPORT_PROFILE, PROFILE_BUCKET_SHIFT, PROFILE_BUCKETS };
+    usb_write_data(header, sizeof(header));
+    usb_write_data((const uint8_t *)histogram, sizeof(histogram));
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (uint8_t i = 0; i < PROFILE_BUCKETS; i++)
+            histogram[i] = 0;
+    }
+}
+
+// Called from the timer0 ISR with the (word) address that was interrupted
+void profile_sample(uint16_t pc) __attribute__((used));
+void profile_sample(uint16_t pc)
+{
+    uint16_t bucket = pc >> PROFILE_BUCKET_SHIFT;
+
+    if (histogram[bucket] != UINT16_MAX)
+        histogram[bucket]++;
+}
+
+// The interrupted program counter is only available from the stack, so the ISR
+// saves the registers that profile_sample may clobber and reads it from there
+// before the compiler can push an unknown number of registers on top of it
+ISR(TIMER0_COMPA_vect, ISR_NAKED)
+{
+    __asm__ volatile (
+        "    push r1\n"
+        "    push r0\n"
+        "    in r0, __SREG__\n"
+        "    push r0\n"
+        "    clr r1\n"
+        "    push r18\n"
+        "    push r19\n"
+        "    push r20\n"
+        "    push r21\n"
+        "    push r22\n"
+        "    push r23\n"
+        "    push r24\n"
+        "    push r25\n"
+        "    push r26\n"
+        "    push r27\n"
+        "    push r30\n"
+        "    push r31\n"
+
+        // 15 bytes have been pushed on top of the return address,
+        // which is stored high byte first
+        "    in r30, __SP_L__\n"
+        "    in r31, __SP_H__\n"
+        "    ldd r25, Z+16\n"
+        "    ldd r24, Z+17\n"
+        "    call profile_sample\n"
+
+        "    pop r31\n"
+        "    pop r30\n"
+        "    pop r27\n"
+        "    pop r26\n"
+        "    pop r25\n"
+        "    pop r24\n"
+        "    pop r23\n"
+        "    pop r22\n"
+        "    pop r21\n"
+        "    pop r20\n"
+        "    pop r19\n"
+        "    pop r18\n"
+        "    pop r0\n"
+        "    out __SREG__, r0\n"
+        "    pop r0\n"
+        "    pop r1\n"
+        "    reti\n");
+}
+
+#endif
@@ -0,0 +1,33 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#include <avr/io.h>
+#include <stdint.h>
+
+#ifndef DOME_HEARTBEAT_PROFILE_H
+#define DOME_HEARTBEAT_PROFILE_H
+
+// Each histogram bucket counts the samples within 2^PROFILE_BUCKET_SHIFT program words
+// The shift is the smallest that lets the buckets cover the whole flash
+// (7 on the ATmega32u4, i.e. 256 bytes of flash per bucket)
+#define PROFILE_BUCKETS      128
+#define PROFILE_FLASH_WORDS  ((FLASHEND + 1UL) / 2)
+
+#if PROFILE_FLASH_WORDS <= (PROFILE_BUCKETS << 6)
+#define PROFILE_BUCKET_SHIFT 6
+#elif PROFILE_FLASH_WORDS <= (PROFILE_BUCKETS << 7)
+#define PROFILE_BUCKET_SHIFT 7
+#elif PROFILE_FLASH_WORDS <= (PROFILE_BUCKETS << 8)
+#define PROFILE_BUCKET_SHIFT 8
+#else
+#error The profiler histogram does not cover this MCU's flash
+#endif
+
+void profile_initialize(void);
+void profile_report(void);
+
+#endif
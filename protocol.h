@@ -0,0 +1,55 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#ifndef DOME_HEARTBEAT_PROTOCOL_H
+#define DOME_HEARTBEAT_PROTOCOL_H
+
+// Byte values 0-240 set the heartbeat timeout and 0xFF sounds the siren.
+// The unused values between are command bytes. The status byte is never
+// 241-253, so any reply is prefixed with its command byte and can be
+// picked out from the regular 2Hz status stream by the host.
+
+// Reply with the learned close step counts: CMD, A steps, B steps (0 = not learned)
+#define CMD_REPORT_CALIBRATION 0xF1
+
+// Forget the learned close step counts and use MAX_SHUTTER_CLOSE_STEPS
+#define CMD_RESET_CALIBRATION  0xF2
+
+// Followed by a lease id and a timeout (0-240, 0 releases the lease)
+#define CMD_PING_LEASE         0xF3
+
+// Reply with the lease state: CMD, expired lease bitmask, remaining time for each lease
+#define CMD_REPORT_LEASES      0xF4
+
+// Followed by 1 to start or 0 to stop streaming the dome serial traffic
+#define CMD_SNIFFER            0xF5
+
+// Prefix for each streamed dome serial record (see sniffer.c)
+#define SNIFFER_RECORD         0xF6
+
+// Reply with the RAM usage as little-endian words: CMD, static bytes, peak stack bytes, never used bytes
+#define CMD_REPORT_MEMORY      0xF7
+
+// Reply with all counters: CMD, counter count, then each counter as a little-endian 32 bit word (see stats.h)
+#define CMD_REPORT_STATS       0xF8
+
+// Reply with the PC sampling histogram and clear it (profiling builds only, see profile.c)
+#define CMD_REPORT_PROFILE     0xF9
+
+// Followed by a device address, register and length (1-8): reply once the read completes
+// with CMD, status, count, then count data bytes (TWI_BUS builds only, see twi.h)
+#define CMD_TWI_READ           0xFA
+
+// Reply with the measured voltages as little-endian millivolts: CMD, then the average, minimum and
+// maximum for the supply and relay coil (ADC_TELEMETRY builds only, see adc.c)
+#define CMD_REPORT_ADC         0xFB
+
+// Prefix for the streamed timestamp epoch records, which are sent
+// whenever the dome serial record timestamps wrap (see sniffer.c)
+#define SNIFFER_SYNC           0xFC
+
+#endif
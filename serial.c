@@ -9,6 +9,8 @@
 #include <avr/interrupt.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include "sniffer.h"
+#include "stats.h"
 
 #define TX_LED_DISABLED   PORTB &= ~_BV(PB3)
 #define TX_LED_ENABLED    PORTB |= _BV(PB3)
@@ -29,6 +31,14 @@ static uint8_t input_buffer[256];
 static uint8_t input_read = 0;
 static volatile uint8_t input_write = 0;
 
+#if BRIDGE_MODE
+// Second copy of the received bytes to forward to the PC through the bridge
+#define BRIDGE_BUFFER_MASK 0x7F
+static uint8_t bridge_buffer[BRIDGE_BUFFER_MASK + 1];
+static uint8_t bridge_read = 0;
+static volatile uint8_t bridge_write = 0;
+#endif
+
 void serial_initialize(void)
 {
 #define BAUD 9600
@@ -47,13 +57,16 @@ void serial_initialize(void)
     // for ticking the TX/RX LEDs
     // Note: this should use a timer with lower interrupt
     // priority than the UDRE to avoid race conditions
+    // The interrupt is only enabled while an LED is lit
     OCR3A = 156;
     TCCR3B = _BV(CS32) | _BV(CS30) | _BV(WGM32);
-    TIMSK3 |= _BV(OCIE3A);
 
     tx_led_pulse = rx_led_pulse = 0;
     input_read = input_write = 0;
     output_read = output_write = 0;
+#if BRIDGE_MODE
+    bridge_read = bridge_write = 0;
+#endif
 }
 
 bool serial_can_read(void)
@@ -81,13 +94,54 @@ void serial_write(uint8_t b)
     UCSR1B |= _BV(UDRIE1);
 }
 
+// Number of bytes that can be written without blocking
+uint8_t serial_write_space(void)
+{
+    return (uint8_t)(output_read - output_write - 1);
+}
+
+// Drop any received bytes that haven't been read yet
+// Must only be called from inside an ISR
+void serial_discard_input(void)
+{
+    input_read = input_write;
+}
+
+// Drop any bytes that are waiting to be sent
+// Must only be called from inside an ISR
+void serial_discard_output(void)
+{
+    output_read = output_write;
+    UCSR1B &= ~_BV(UDRIE1);
+}
+
+#if BRIDGE_MODE
+// Copy up to length received bytes into data for forwarding to the PC
+// Returns the number of bytes copied
+uint8_t serial_bridge_read(uint8_t *data, uint8_t length)
+{
+    uint8_t count = 0;
+    while (count < length && bridge_read != bridge_write)
+    {
+        data[count++] = bridge_buffer[bridge_read];
+        bridge_read = (bridge_read + 1) & BRIDGE_BUFFER_MASK;
+    }
+
+    return count;
+}
+#endif
+
 ISR(USART1_UDRE_vect)
 {
     if (output_write != output_read)
     {
-        UDR1 = output_buffer[output_read++];
+        uint8_t b = output_buffer[output_read++];
+        UDR1 = b;
+        sniffer_record(SNIFFER_TO_DOME, b);
+        stats_increment(STATS_SERIAL_BYTES_OUT);
         TX_LED_ENABLED;
         tx_led_pulse = TX_RX_LED_PULSE_MS;
+        TIMSK3 |= _BV(OCIE3A);
     }
 
     // Ran out of data to send - disable the interrupt
@@ -97,9 +151,35 @@ ISR(USART1_UDRE_vect)
 
 ISR(USART1_RX_vect)
 {
-    input_buffer[(uint8_t)(input_write++)] = UDR1;
+    // The hardware flags a byte lost before this one was read
+    if (UCSR1A & _BV(DOR1))
+        stats_increment(STATS_SERIAL_OVERRUNS);
+
+    uint8_t b = UDR1;
+    stats_increment(STATS_SERIAL_BYTES_IN);
+
+    // The oldest unread byte is about to be overwritten
+    if ((uint8_t)(input_write + 1) == input_read)
+        stats_increment(STATS_SERIAL_OVERRUNS);
+
+    input_buffer[(uint8_t)(input_write++)] = b;
+    sniffer_record(SNIFFER_FROM_DOME, b);
+
+#if BRIDGE_MODE
+    // Drop bytes if the PC isn't keeping up
+    uint8_t next = (bridge_write + 1) & BRIDGE_BUFFER_MASK;
+    if (next != bridge_read)
+    {
+        bridge_buffer[bridge_write] = b;
+        bridge_write = next;
+    }
+    else
+        stats_increment(STATS_BRIDGE_DROPPED);
+#endif
+
     RX_LED_ENABLED;
     rx_led_pulse = TX_RX_LED_PULSE_MS;
+    TIMSK3 |= _BV(OCIE3A);
 }
 
 ISR(TIMER3_COMPA_vect)
@@ -116,4 +196,8 @@ ISR(TIMER3_COMPA_vect)
         TX_LED_DISABLED;
     if (rx_led_pulse == 0)
         RX_LED_DISABLED;
+
+    // Stop ticking while both LEDs are disabled
+    if (!tx_led_pulse && !rx_led_pulse)
+        TIMSK3 &= ~_BV(OCIE3A);
 }
\ No newline at end of file
@@ -15,5 +15,12 @@ void serial_initialize(void);
 bool serial_can_read(void);
 uint8_t serial_read(void);
 void serial_write(uint8_t b);
+uint8_t serial_write_space(void);
+void serial_discard_input(void);
+void serial_discard_output(void);
+
+#if BRIDGE_MODE
+uint8_t serial_bridge_read(uint8_t *data, uint8_t length);
+#endif
 
 #endif
@@ -0,0 +1,145 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "protocol.h"
+#include "sniffer.h"
+#include "stats.h"
+#include "usb.h"
+
+// Each record is sent as 4 bytes: SNIFFER_RECORD, data, timestamp low, direction | timestamp high
+// The 14 bit timestamp counts in 256us increments, and wraps every 4.2 seconds
+// A sync record (SNIFFER_SYNC, 0, epoch low, epoch high) is sent before the first record
+// after the sniffer is enabled and before the first record after each wrap, so that the
+// host can rebuild the full time of each record: ((epoch << 14) | timestamp) * 256us
+#define SNIFFER_RECORD_SIZE 4
+
+// Records are sent in batches that exactly fill the CDC packets
+#define SNIFFER_BATCH_RECORDS (CDC_PACKET_SIZE / SNIFFER_RECORD_SIZE)
+
+typedef struct
+{
+    // SNIFFER_RECORD or SNIFFER_SYNC
+    uint8_t type;
+    uint8_t data;
+    uint16_t timestamp;
+} sniffer_record_t;
+
+#define SNIFFER_BUFFER_MASK 0x1F
+static sniffer_record_t records[SNIFFER_BUFFER_MASK + 1];
+static uint8_t records_read = 0;
+static volatile uint8_t records_write = 0;
+
+static volatile bool enabled = false;
+
+// Timestamp epoch (number of timestamp wraps) that the host was last sent
+static uint16_t epoch;
+static volatile bool synced = false;
+
+// Number of timer1 periods (0.5 seconds) since startup
+static volatile uint32_t ticks = 0;
+
+void sniffer_enable(bool enable)
+{
+    synced = false;
+    enabled = enable;
+}
+
+// Called from the timer1 ISR every 0.5 seconds
+void sniffer_tick(void)
+{
+    ticks++;
+}
+
+// Add a byte to the record buffer
+// Must only be called from inside an ISR
+void sniffer_record(uint8_t direction, uint8_t b)
+{
+    if (!enabled)
+        return;
+
+    // Timer1 counts from 0 to 7812 in 64us increments every 0.5 seconds
+    // If it has just wrapped then the timer ISR won't have updated ticks yet.
+    // The counter may have wrapped between reading it and the flag, so it is
+    // read again once the flag is set to get a count from after the wrap
+    uint16_t timer = TCNT1;
+    uint32_t tick = ticks;
+    if (TIFR1 & _BV(OCF1A))
+    {
+        timer = TCNT1;
+        tick++;
+    }
+
+    uint32_t time = tick * 7813UL + timer;
+
+    // Drop records if the USB connection isn't keeping up
+    uint16_t record_epoch = time >> 16;
+    bool sync = !synced || record_epoch != epoch;
+    uint8_t space = SNIFFER_BUFFER_MASK - ((records_write - records_read) & SNIFFER_BUFFER_MASK);
+    if (space < (sync ? 2 : 1))
+    {
+        stats_increment(STATS_SNIFFER_DROPPED);
+        return;
+    }
+
+    if (sync)
+    {
+        records[records_write].type = SNIFFER_SYNC;
+        records[records_write].data = 0;
+        records[records_write].timestamp = record_epoch;
+        records_write = (records_write + 1) & SNIFFER_BUFFER_MASK;
+        epoch = record_epoch;
+        synced = true;
+    }
+
+    records[records_write].type = SNIFFER_RECORD;
+    records[records_write].data = b;
+    records[records_write].timestamp = ((time >> 2) & 0x3FFF) | ((uint16_t)direction << 14);
+    records_write = (records_write + 1) & SNIFFER_BUFFER_MASK;
+}
+
+// Add a byte exchanged with the host PC to the record buffer
+// Called from the main loop, so must not race the ISRs that record dome traffic
+void sniffer_record_host(uint8_t direction, uint8_t b)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        sniffer_record(direction, b);
+    }
+}
+
+// Send any complete batches of records to the host
+// Incomplete batches are only sent if flush is true
+void sniffer_poll(bool flush)
+{
+    uint8_t buffer[SNIFFER_BATCH_RECORDS * SNIFFER_RECORD_SIZE];
+    for (;;)
+    {
+        uint8_t pending = (records_write - records_read) & SNIFFER_BUFFER_MASK;
+        if (pending == 0 || (pending < SNIFFER_BATCH_RECORDS && !flush))
+            return;
+
+        if (pending > SNIFFER_BATCH_RECORDS)
+            pending = SNIFFER_BATCH_RECORDS;
+
+        uint8_t length = 0;
+        for (uint8_t i = 0; i < pending; i++)
+        {
+            sniffer_record_t *record = &records[records_read];
+            buffer[length++] = record->type;
+            buffer[length++] = record->data;
+            buffer[length++] = record->timestamp & 0xFF;
+            buffer[length++] = record->timestamp >> 8;
+            records_read = (records_read + 1) & SNIFFER_BUFFER_MASK;
+        }
+
+        usb_write_data(buffer, length);
+    }
+}
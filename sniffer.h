@@ -0,0 +1,26 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef DOME_HEARTBEAT_SNIFFER_H
+#define DOME_HEARTBEAT_SNIFFER_H
+
+// Direction of a sniffed byte, stored in the top two bits of the record timestamp
+#define SNIFFER_FROM_DOME 0
+#define SNIFFER_TO_DOME   1
+#define SNIFFER_FROM_PC   2
+#define SNIFFER_TO_PC     3
+
+void sniffer_enable(bool enabled);
+void sniffer_tick(void);
+void sniffer_record(uint8_t direction, uint8_t b);
+void sniffer_record_host(uint8_t direction, uint8_t b);
+void sniffer_poll(bool flush);
+
+#endif
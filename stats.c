@@ -0,0 +1,33 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#include <stdint.h>
+#include <util/atomic.h>
+#include "stats.h"
+
+volatile uint32_t stats[STATS_COUNT];
+
+// Copy all counters into data as little-endian words
+// Interrupts are disabled during the copy so the counters are consistent with each other
+// Returns the number of bytes written, which is always STATS_COUNT * 4
+uint8_t stats_snapshot(uint8_t *data)
+{
+    uint8_t length = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (uint8_t i = 0; i < STATS_COUNT; i++)
+        {
+            uint32_t value = stats[i];
+            data[length++] = value & 0xFF;
+            data[length++] = (value >> 8) & 0xFF;
+            data[length++] = (value >> 16) & 0xFF;
+            data[length++] = value >> 24;
+        }
+    }
+
+    return length;
+}
@@ -0,0 +1,50 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#include <stdint.h>
+
+#ifndef DOME_HEARTBEAT_STATS_H
+#define DOME_HEARTBEAT_STATS_H
+
+// Counters incremented from the main loop
+#define STATS_USB_BYTES_IN       0
+#define STATS_USB_BYTES_OUT      1
+#define STATS_USB_SEND_FAILED    2
+#define STATS_USB_DTR_DROPPED    3
+#define STATS_TRIP_RESETS        4
+
+// Counters incremented from ISRs
+#define STATS_SERIAL_BYTES_IN    5
+#define STATS_SERIAL_BYTES_OUT   6
+#define STATS_SERIAL_OVERRUNS    7
+#define STATS_BRIDGE_DROPPED     8
+#define STATS_SNIFFER_DROPPED    9
+#define STATS_TRIPS             10
+#define STATS_CLOSES            11
+
+#define STATS_COUNT             12
+
+extern volatile uint32_t stats[STATS_COUNT];
+
+// Increment a counter, saturating at its maximum value
+// Each counter is only incremented from a single context (the main loop,
+// or ISRs which don't nest), so no locking is needed
+static inline void stats_increment(uint8_t counter)
+{
+    if (stats[counter] != UINT32_MAX)
+        stats[counter]++;
+}
+
+static inline void stats_add(uint8_t counter, uint16_t count)
+{
+    uint32_t value = stats[counter] + count;
+    stats[counter] = value < count ? UINT32_MAX : value;
+}
+
+uint8_t stats_snapshot(uint8_t *data);
+
+#endif
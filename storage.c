@@ -0,0 +1,560 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#if MASS_STORAGE
+
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <LUFA/Drivers/USB/USB.h>
+#include "storage.h"
+#include "stats.h"
+
+// The host sees a read-only FAT12 volume that is generated on the fly as each sector is read:
+// sector 0 is the boot sector, sector 1 the FAT, sector 2 the root directory and the files
+// are stored from sector 3 onwards. Each file is given STORAGE_FILE_SECTORS consecutive
+// clusters (of one sector each) and its contents are regenerated for every read, so
+// copying a file always returns the current values without storing a disk image
+#define STORAGE_FAT_SECTOR    1
+#define STORAGE_ROOT_SECTOR   2
+#define STORAGE_DATA_SECTOR   3
+#define STORAGE_ROOT_ENTRIES  (STORAGE_SECTOR_SIZE / 32)
+#define STORAGE_FILE_SECTORS  2
+#define STORAGE_FIRST_CLUSTER 2
+
+// Files are written with a fixed timestamp (2017-01-01 00:00)
+#define STORAGE_FILE_DATE     (((2017 - 1980) << 9) | (1 << 5) | 1)
+
+// FAT12 directory entry attributes
+#define STORAGE_ATTR_READ_ONLY    0x01
+#define STORAGE_ATTR_VOLUME_LABEL 0x08
+
+// A read is abandoned if the host doesn't accept the next packet within this time
+#define STORAGE_READ_TIMEOUT_MS 100
+
+// Each line of a file is a name padded to this width followed by a right-aligned value
+#define STORAGE_NAME_WIDTH    24
+#define STORAGE_VALUE_WIDTH   10
+
+// The first 62 bytes of the boot sector: a jump instruction, the BIOS parameter block
+// describing the volume layout above, and the extended boot record
+static const uint8_t boot_sector[] PROGMEM =
+{
+    0xEB, 0x3C, 0x90,                                      // Jump to the (empty) boot code
+    'M', 'S', 'D', 'O', 'S', '5', '.', '0',                // OEM name
+    STORAGE_SECTOR_SIZE & 0xFF, STORAGE_SECTOR_SIZE >> 8,  // Bytes per sector
+    1,                                                     // Sectors per cluster
+    1, 0,                                                  // Reserved sectors (the boot sector)
+    1,                                                     // Number of FATs
+    STORAGE_ROOT_ENTRIES, 0,                               // Root directory entries
+    STORAGE_TOTAL_SECTORS & 0xFF, STORAGE_TOTAL_SECTORS >> 8, // Total sectors
+    0xF8,                                                  // Media descriptor (fixed disk)
+    1, 0,                                                  // Sectors per FAT
+    1, 0,                                                  // Sectors per track
+    1, 0,                                                  // Number of heads
+    0, 0, 0, 0,                                            // Hidden sectors
+    0, 0, 0, 0,                                            // Total sectors (32 bit)
+    0x80,                                                  // Drive number
+    0,                                                     // Reserved
+    0x29,                                                  // Extended boot signature
+    0x17, 0x20, 0x01, 0x01,                                // Volume serial number
+    'H', 'E', 'A', 'R', 'T', 'B', 'E', 'A', 'T', ' ', ' ', // Volume label
+    'F', 'A', 'T', '1', '2', ' ', ' ', ' ',                // File system type
+};
+
+// Offset of the volume label within the boot sector
+#define BOOT_SECTOR_LABEL 43
+
+static const SCSI_Inquiry_Response_t inquiry_data PROGMEM =
+{
+    .DeviceType          = 0x00, // Direct access block device
+    .PeripheralQualifier = 0,
+
+    .Removable           = true,
+
+    .Version             = 0,
+
+    .ResponseDataFormat  = 2,
+    .NormACA             = false,
+    .TrmTsk              = false,
+    .AERC                = false,
+
+    .AdditionalLength    = 0x1F,
+
+    .SoftReset           = false,
+    .CmdQue              = false,
+    .Linked              = false,
+    .Sync                = false,
+    .WideBus16Bit        = false,
+    .WideBus32Bit        = false,
+    .RelAddr             = false,
+
+    .VendorID            = "Chote   ",
+    .ProductID           = "Dome Heartbeat  ",
+    .RevisionID          = {'0', '.', '0', '1'},
+};
+
+// Sense data describing the result of the last command, returned by REQUEST SENSE
+static SCSI_Request_Sense_Response_t sense_data =
+{
+    .ResponseCode        = 0x70,
+    .AdditionalLength    = 0x0A,
+};
+
+// Counter names in the order of their STATS_ indices (see stats.h)
+static const char stats_names[STATS_COUNT][STORAGE_NAME_WIDTH] PROGMEM =
+{
+    "usb_bytes_in",
+    "usb_bytes_out",
+    "usb_send_failed",
+    "usb_dtr_dropped",
+    "trip_resets",
+    "serial_bytes_in",
+    "serial_bytes_out",
+    "serial_overruns",
+    "bridge_dropped",
+    "sniffer_dropped",
+    "trips",
+    "closes",
+};
+
+typedef struct
+{
+    char name[STORAGE_NAME_WIDTH];
+    uint16_t value;
+} storage_option_t;
+
+static const storage_option_t build_options[] PROGMEM =
+{
+    { "MAX_SHUTTER_CLOSE_STEPS", MAX_SHUTTER_CLOSE_STEPS },
+    { "CLOSE_STEP_MARGIN", CLOSE_STEP_MARGIN },
+    { "HAS_BUMPER_GUARD", HAS_BUMPER_GUARD },
+    { "EXTERNAL_SIREN", EXTERNAL_SIREN },
+    { "CLOSE_B_FIRST", CLOSE_B_FIRST },
+    { "CLOSE_INTERLEAVED", CLOSE_INTERLEAVED },
+    { "FAST_CLOSE_INPUT", FAST_CLOSE_INPUT },
+    { "LEASE_POLICY", LEASE_POLICY },
+    { "BRIDGE_MODE", BRIDGE_MODE },
+    { "PROFILE", PROFILE },
+    { "CDC_PACKET_SIZE", CDC_PACKET_SIZE },
+    { "CDC_DATA_BANKS", CDC_DATA_BANKS },
+    { "TWI_BUS", TWI_BUS },
+    { "ADC_TELEMETRY", ADC_TELEMETRY },
+    { "ADC_DIVIDER", ADC_DIVIDER },
+    { "LOW_VOLTAGE_TRIP_MV", LOW_VOLTAGE_TRIP_MV },
+};
+
+// Learned close step counts (see main.c)
+extern uint8_t EEMEM shutter_a_learned_steps_eeprom;
+extern uint8_t EEMEM shutter_b_learned_steps_eeprom;
+
+// Handles the heartbeat pings and status reports (see main.c)
+void poll_usb(void);
+
+static void generate_stats(void);
+static void generate_config(void);
+
+typedef struct
+{
+    // 8.3 name, padded with spaces
+    char name[11];
+    void (*generate)(void);
+} storage_file_t;
+
+static const storage_file_t files[] PROGMEM =
+{
+    { "STATS   TXT", generate_stats },
+    { "CONFIG  TXT", generate_config },
+};
+
+#define STORAGE_FILE_COUNT (sizeof(files) / sizeof(files[0]))
+
+// File sizes never change because every value is printed with a fixed width,
+// so they are measured once at startup for the directory entries and FAT
+// Each file must fit in STORAGE_FILE_SECTORS sectors
+static uint16_t file_sizes[STORAGE_FILE_COUNT];
+
+// The generators write every byte of their file through emit(), which
+// counts the bytes and only sends those that fall inside the sector being read
+// window_start is UINT16_MAX while the file sizes are being measured
+static uint16_t position;
+static uint16_t window_start;
+
+// Interface of the command being processed, to check for a reset from the host
+static USB_ClassInfo_MS_Device_t *current_interface;
+
+// Set if the host stops reading, after which the rest of the command is skipped
+static bool aborted;
+
+// Number of bytes of the current command that have been written to the endpoint,
+// and the number that the host has accepted (i.e. in packets that it has read)
+static uint32_t written;
+static uint32_t accepted;
+
+static bool reset_requested(void)
+{
+    return current_interface->State.IsMassStoreReset;
+}
+
+// Send a byte to the host, moving on to the next packet when the bank is full
+static void send_byte(uint8_t b)
+{
+    if (aborted)
+        return;
+
+    if (!Endpoint_IsReadWriteAllowed())
+    {
+        Endpoint_ClearIN();
+        if (Endpoint_WaitUntilReady_Bounded(STORAGE_READ_TIMEOUT_MS, reset_requested) != ENDPOINT_READYWAIT_NoError)
+        {
+            aborted = true;
+            return;
+        }
+
+        // The single bank is free again, so the host has read everything before this byte
+        accepted = written;
+    }
+
+    Endpoint_Write_8(b);
+    written++;
+}
+
+static void emit(uint8_t b)
+{
+    if (window_start != UINT16_MAX && position >= window_start && position - window_start < STORAGE_SECTOR_SIZE)
+        send_byte(b);
+
+    position++;
+}
+
+// Emit a string from flash, padded with spaces to width
+static void emit_name(const char *name, uint8_t width)
+{
+    char c;
+    while (width > 0 && (c = pgm_read_byte(name++)) != '\0')
+    {
+        emit(c);
+        width--;
+    }
+
+    while (width-- > 0)
+        emit(' ');
+}
+
+// Emit a line containing a name followed by a right-aligned decimal value
+static void emit_line(const char *name, uint32_t value)
+{
+    char digits[STORAGE_VALUE_WIDTH];
+    uint8_t i = STORAGE_VALUE_WIDTH;
+    do
+    {
+        digits[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0 && i > 0);
+
+    emit_name(name, STORAGE_NAME_WIDTH);
+    for (uint8_t j = 0; j < STORAGE_VALUE_WIDTH; j++)
+        emit(j < i ? ' ' : digits[j]);
+
+    emit('\r');
+    emit('\n');
+}
+
+static void generate_stats(void)
+{
+    uint8_t snapshot[STATS_COUNT * 4];
+    stats_snapshot(snapshot);
+
+    for (uint8_t i = 0; i < STATS_COUNT; i++)
+    {
+        uint8_t *value = snapshot + 4 * i;
+        emit_line(stats_names[i], value[0] | ((uint32_t)value[1] << 8) | ((uint32_t)value[2] << 16) | ((uint32_t)value[3] << 24));
+    }
+}
+
+static void generate_config(void)
+{
+    for (uint8_t i = 0; i < sizeof(build_options) / sizeof(build_options[0]); i++)
+        emit_line(build_options[i].name, pgm_read_word(&build_options[i].value));
+
+    emit_line(PSTR("LEARNED_STEPS_A"), eeprom_read_byte(&shutter_a_learned_steps_eeprom));
+    emit_line(PSTR("LEARNED_STEPS_B"), eeprom_read_byte(&shutter_b_learned_steps_eeprom));
+}
+
+static void generate_file(uint8_t file)
+{
+    position = 0;
+    ((void (*)(void))pgm_read_word(&files[file].generate))();
+}
+
+// Number of clusters used by a file
+static uint8_t file_clusters(uint8_t file)
+{
+    uint16_t clusters = (file_sizes[file] + STORAGE_SECTOR_SIZE - 1) / STORAGE_SECTOR_SIZE;
+    return clusters > 0 ? clusters : 1;
+}
+
+// FAT12 table entry for a cluster
+static uint16_t fat_entry(uint16_t cluster)
+{
+    // The first two entries hold the media descriptor and end of chain marker
+    if (cluster < STORAGE_FIRST_CLUSTER)
+        return cluster == 0 ? 0xFF8 : 0xFFF;
+
+    uint16_t file = (cluster - STORAGE_FIRST_CLUSTER) / STORAGE_FILE_SECTORS;
+    uint8_t index = (cluster - STORAGE_FIRST_CLUSTER) % STORAGE_FILE_SECTORS;
+    if (file >= STORAGE_FILE_COUNT || index >= file_clusters(file))
+        return 0x000;
+
+    // Chain to the next cluster, or mark the end of the file
+    return index + 1 < file_clusters(file) ? cluster + 1 : 0xFFF;
+}
+
+static void send_fat_sector(void)
+{
+    // Pairs of 12 bit entries are packed into three bytes
+    for (uint16_t i = 0; i < STORAGE_SECTOR_SIZE; i++)
+    {
+        uint16_t cluster = i / 3 * 2;
+        uint8_t b;
+        switch (i % 3)
+        {
+            case 0:
+                b = fat_entry(cluster) & 0xFF;
+                break;
+            case 1:
+                b = (fat_entry(cluster) >> 8) | ((fat_entry(cluster + 1) & 0x0F) << 4);
+                break;
+            default:
+                b = fat_entry(cluster + 1) >> 4;
+                break;
+        }
+
+        send_byte(b);
+    }
+}
+
+static void send_directory_entry(const char *name, uint8_t attributes, uint16_t cluster, uint16_t size)
+{
+    uint8_t entry[32] = { 0 };
+    for (uint8_t i = 0; i < 11; i++)
+        entry[i] = pgm_read_byte(name + i);
+
+    entry[11] = attributes;
+    entry[24] = STORAGE_FILE_DATE & 0xFF;
+    entry[25] = STORAGE_FILE_DATE >> 8;
+    entry[26] = cluster & 0xFF;
+    entry[27] = cluster >> 8;
+    entry[28] = size & 0xFF;
+    entry[29] = size >> 8;
+
+    for (uint8_t i = 0; i < sizeof(entry); i++)
+        send_byte(entry[i]);
+}
+
+static void send_root_sector(void)
+{
+    // The label in the root directory is the one shown by most hosts
+    send_directory_entry((const char *)boot_sector + BOOT_SECTOR_LABEL, STORAGE_ATTR_VOLUME_LABEL, 0, 0);
+
+    for (uint8_t i = 0; i < STORAGE_FILE_COUNT; i++)
+        send_directory_entry(files[i].name, STORAGE_ATTR_READ_ONLY,
+            STORAGE_FIRST_CLUSTER + i * STORAGE_FILE_SECTORS, file_sizes[i]);
+
+    for (uint16_t i = (STORAGE_FILE_COUNT + 1) * 32; i < STORAGE_SECTOR_SIZE; i++)
+        send_byte(0);
+}
+
+static void send_sector(uint16_t sector)
+{
+    if (sector == 0)
+    {
+        for (uint16_t i = 0; i < STORAGE_SECTOR_SIZE; i++)
+        {
+            if (i < sizeof(boot_sector))
+                send_byte(pgm_read_byte(&boot_sector[i]));
+            else if (i == STORAGE_SECTOR_SIZE - 2)
+                send_byte(0x55);
+            else if (i == STORAGE_SECTOR_SIZE - 1)
+                send_byte(0xAA);
+            else
+                send_byte(0);
+        }
+
+        return;
+    }
+
+    if (sector == STORAGE_FAT_SECTOR)
+    {
+        send_fat_sector();
+        return;
+    }
+
+    if (sector == STORAGE_ROOT_SECTOR)
+    {
+        send_root_sector();
+        return;
+    }
+
+    uint16_t file = (sector - STORAGE_DATA_SECTOR) / STORAGE_FILE_SECTORS;
+    uint16_t sent = 0;
+    if (file < STORAGE_FILE_COUNT)
+    {
+        window_start = (sector - STORAGE_DATA_SECTOR) % STORAGE_FILE_SECTORS * STORAGE_SECTOR_SIZE;
+        generate_file(file);
+
+        if (position > window_start)
+            sent = position - window_start < STORAGE_SECTOR_SIZE ? position - window_start : STORAGE_SECTOR_SIZE;
+    }
+
+    // Fill the rest of the sector (or unused sectors) with zeros
+    for (; sent < STORAGE_SECTOR_SIZE; sent++)
+        send_byte(0);
+}
+
+static void set_sense(uint8_t key, uint8_t code, uint8_t qualifier)
+{
+    sense_data.SenseKey = key;
+    sense_data.AdditionalSenseCode = code;
+    sense_data.AdditionalSenseQualifier = qualifier;
+}
+
+// Send a fixed response, truncated or zero-padded to the length requested by the host
+static void send_response(const void *data, uint8_t length, bool progmem, uint16_t requested)
+{
+    uint16_t count = length < requested ? length : requested;
+    if (progmem)
+        Endpoint_Write_PStream_LE(data, count, NULL);
+    else
+        Endpoint_Write_Stream_LE(data, count, NULL);
+
+    Endpoint_Null_Stream(requested - count, NULL);
+    Endpoint_ClearIN();
+    current_interface->State.CommandBlock.DataTransferLength -= requested;
+}
+
+static bool read_sectors(const uint8_t *command)
+{
+    uint32_t first = ((uint32_t)command[2] << 24) | ((uint32_t)command[3] << 16) | ((uint16_t)command[4] << 8) | command[5];
+    uint16_t count = ((uint16_t)command[7] << 8) | command[8];
+
+    if (first >= STORAGE_TOTAL_SECTORS || count > STORAGE_TOTAL_SECTORS - first)
+    {
+        set_sense(SCSI_SENSE_KEY_ILLEGAL_REQUEST, SCSI_ASENSE_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE, SCSI_ASENSEQ_NO_QUALIFIER);
+        return false;
+    }
+
+    aborted = false;
+    written = accepted = 0;
+    for (uint16_t i = 0; i < count && !aborted; i++)
+    {
+        // Keep handling the heartbeat pings between sectors, so that
+        // reading the whole disk can't make a short lease expire
+        if (i > 0)
+        {
+            poll_usb();
+            Endpoint_SelectEndpoint(current_interface->Config.DataINEndpoint.Address);
+        }
+
+        send_sector(first + i);
+    }
+
+    // Report the data that the host didn't receive as the residue of a failed command
+    if (aborted)
+    {
+        current_interface->State.CommandBlock.DataTransferLength -= accepted;
+        set_sense(SCSI_SENSE_KEY_ABORTED_COMMAND, SCSI_ASENSE_NO_ADDITIONAL_INFORMATION, SCSI_ASENSEQ_NO_QUALIFIER);
+        return false;
+    }
+
+    if (!Endpoint_IsReadWriteAllowed())
+        Endpoint_ClearIN();
+
+    current_interface->State.CommandBlock.DataTransferLength -= written;
+    return true;
+}
+
+void storage_initialize(void)
+{
+    window_start = UINT16_MAX;
+    for (uint8_t i = 0; i < STORAGE_FILE_COUNT; i++)
+    {
+        generate_file(i);
+        file_sizes[i] = position;
+    }
+}
+
+// Called by LUFA from the main loop (inside MS_Device_USBTask) for each command from the host
+bool CALLBACK_MS_Device_SCSICommandReceived(USB_ClassInfo_MS_Device_t* const MSInterfaceInfo)
+{
+    current_interface = MSInterfaceInfo;
+    const uint8_t *command = MSInterfaceInfo->State.CommandBlock.SCSICommandData;
+    uint16_t requested;
+    bool success = true;
+
+    switch (command[0])
+    {
+        case SCSI_CMD_INQUIRY:
+            requested = ((uint16_t)command[3] << 8) | command[4];
+
+            // Only the standard inquiry data is supported
+            if ((command[1] & 0x03) || command[2])
+            {
+                set_sense(SCSI_SENSE_KEY_ILLEGAL_REQUEST, SCSI_ASENSE_INVALID_FIELD_IN_CDB, SCSI_ASENSEQ_NO_QUALIFIER);
+                return false;
+            }
+
+            send_response(&inquiry_data, sizeof(inquiry_data), true, requested);
+            break;
+        case SCSI_CMD_REQUEST_SENSE:
+            send_response(&sense_data, sizeof(sense_data), false, command[4]);
+            break;
+        case SCSI_CMD_READ_CAPACITY_10:
+        {
+            uint8_t capacity[] =
+            {
+                0, 0, (STORAGE_TOTAL_SECTORS - 1) >> 8, (STORAGE_TOTAL_SECTORS - 1) & 0xFF,
+                0, 0, STORAGE_SECTOR_SIZE >> 8, STORAGE_SECTOR_SIZE & 0xFF
+            };
+
+            send_response(capacity, sizeof(capacity), false, sizeof(capacity));
+            break;
+        }
+        case SCSI_CMD_MODE_SENSE_6:
+        {
+            // Report that the medium is write protected, so the host mounts it read-only
+            uint8_t mode[] = { 0x03, 0x00, 0x80, 0x00 };
+            send_response(mode, sizeof(mode), false, command[4]);
+            break;
+        }
+        case SCSI_CMD_READ_10:
+            success = read_sectors(command);
+            break;
+        case SCSI_CMD_WRITE_10:
+            set_sense(SCSI_SENSE_KEY_DATA_PROTECT, SCSI_ASENSE_WRITE_PROTECTED, SCSI_ASENSEQ_NO_QUALIFIER);
+            return false;
+        case SCSI_CMD_TEST_UNIT_READY:
+        case SCSI_CMD_SEND_DIAGNOSTIC:
+        case SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL:
+        case SCSI_CMD_START_STOP_UNIT:
+        case SCSI_CMD_VERIFY_10:
+            // Nothing to do: the virtual disk is always ready
+            MSInterfaceInfo->State.CommandBlock.DataTransferLength = 0;
+            break;
+        default:
+            set_sense(SCSI_SENSE_KEY_ILLEGAL_REQUEST, SCSI_ASENSE_INVALID_COMMAND, SCSI_ASENSEQ_NO_QUALIFIER);
+            return false;
+    }
+
+    if (success)
+        set_sense(SCSI_SENSE_KEY_GOOD, SCSI_ASENSE_NO_ADDITIONAL_INFORMATION, SCSI_ASENSEQ_NO_QUALIFIER);
+
+    return success;
+}
+
+#endif
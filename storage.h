@@ -0,0 +1,22 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#include <stdint.h>
+
+#ifndef DOME_HEARTBEAT_STORAGE_H
+#define DOME_HEARTBEAT_STORAGE_H
+
+// Size in bytes of each sector of the virtual disk
+#define STORAGE_SECTOR_SIZE   512
+
+// Total number of sectors reported to the host
+// Sectors past the end of the files read as zeros
+#define STORAGE_TOTAL_SECTORS 128
+
+void storage_initialize(void);
+
+#endif
@@ -0,0 +1,475 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+// Runs a built main.elf in simavr and checks the trip and close timing against a
+// simulated dome on USART1. USB is never attached, so the heartbeat leases are
+// set by writing to the firmware's RAM, in the same way as the USB ping would
+
+#include <fcntl.h>
+#include <gelf.h>
+#include <libelf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_uart.h>
+
+#define F_CPU 16000000UL
+
+// Timer1 interrupts every (OCR1A + 1) * 1024 clocks
+#define TICK_CYCLES (7813UL * 1024)
+
+// Allowed difference between the expected and simulated time of an event,
+// which covers where in the timer1 ISR the event happens
+#define TOLERANCE_CYCLES (F_CPU / 10000)
+
+#define MS_CYCLES(ms) ((avr_cycle_count_t)(ms) * (F_CPU / 1000))
+#define US_CYCLES(us) ((avr_cycle_count_t)(us) * (F_CPU / 1000000))
+
+// The fast-close input is debounced for 8 timer1 clocks after its last edge
+#define DEBOUNCE_CYCLES (8UL * 1024)
+
+// Number of steps that the simulated dome needs to close each shutter
+#define DOME_CLOSE_STEPS 3
+
+// Bytes sent to the dome, with the cycle that each was sent on
+#define DOME_LOG_SIZE 256
+static uint8_t dome_log[DOME_LOG_SIZE];
+static avr_cycle_count_t dome_log_cycles[DOME_LOG_SIZE];
+static int dome_log_length = 0;
+
+static int dome_a_steps = 0;
+static int dome_b_steps = 0;
+
+// The relay (PC6) connects the dome to the Arduino while it is enabled
+static bool relay_enabled = false;
+static avr_cycle_count_t relay_changed_cycle = 0;
+
+static avr_t *avr;
+static avr_irq_t *dome_input;
+
+// Fast-close input (D8 / PB4), asserted by pulling it low
+static avr_irq_t *fast_close_input;
+
+// Data addresses of the firmware variables used by the scenarios
+static uint16_t leases_address;
+static uint16_t lease_timeouts_address;
+static uint16_t triggered_address;
+static uint16_t state_mirror_checksum_address;
+
+// RAM between the static variables and the top of the stack, which memory.c
+// fills with STACK_CANARY at boot so that the stack's high-water mark can be found
+#define STACK_CANARY 0xC5
+static uint16_t end_address;
+static uint16_t stack_address;
+
+static void fail(const char *message)
+{
+    fprintf(stderr, "FAIL: %s (at %.6f s)\n", message, (double)avr->cycle / F_CPU);
+    exit(1);
+}
+
+// Find the data address of a variable in the firmware's symbol table
+static uint16_t find_symbol(const char *path, const char *name)
+{
+    elf_version(EV_CURRENT);
+    int fd = open(path, O_RDONLY);
+    Elf *elf = fd >= 0 ? elf_begin(fd, ELF_C_READ, NULL) : NULL;
+    if (!elf)
+    {
+        fprintf(stderr, "unable to read %s\n", path);
+        exit(2);
+    }
+
+    Elf_Scn *section = NULL;
+    while ((section = elf_nextscn(elf, section)) != NULL)
+    {
+        GElf_Shdr header;
+        gelf_getshdr(section, &header);
+        if (header.sh_type != SHT_SYMTAB)
+            continue;
+
+        Elf_Data *data = elf_getdata(section, NULL);
+        for (size_t i = 0; i < header.sh_size / header.sh_entsize; i++)
+        {
+            GElf_Sym symbol;
+            gelf_getsym(data, i, &symbol);
+            if (strcmp(elf_strptr(elf, header.sh_link, symbol.st_name), name) == 0)
+            {
+                elf_end(elf);
+                close(fd);
+
+                // Data addresses are offset by 0x800000 to separate them from flash
+                return symbol.st_value & 0xFFFF;
+            }
+        }
+    }
+
+    fprintf(stderr, "%s is missing from %s\n", name, path);
+    exit(2);
+}
+
+// Simulated dome: each step command moves its shutter, and the
+// shutter reports that it is closed once it has been fully stepped
+static void dome_receive(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    if (dome_log_length < DOME_LOG_SIZE)
+    {
+        dome_log[dome_log_length] = value;
+        dome_log_cycles[dome_log_length++] = avr->cycle;
+    }
+
+    if (value == 'A' && ++dome_a_steps >= DOME_CLOSE_STEPS)
+        avr_raise_irq(dome_input, 'X');
+
+    if (value == 'B' && ++dome_b_steps >= DOME_CLOSE_STEPS)
+        avr_raise_irq(dome_input, 'Y');
+}
+
+static void relay_changed(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    if ((value != 0) == relay_enabled)
+        return;
+
+    relay_enabled = value != 0;
+    relay_changed_cycle = avr->cycle;
+}
+
+static void run_for(avr_cycle_count_t cycles)
+{
+    avr_cycle_count_t end = avr->cycle + cycles;
+    while (avr->cycle < end)
+    {
+        int state = avr_run(avr);
+        if (state == cpu_Done || state == cpu_Crashed)
+            fail("firmware stopped");
+    }
+}
+
+// Run until the condition is true, failing if it takes longer than timeout cycles
+static void run_until(bool (*condition)(void), avr_cycle_count_t timeout, const char *message)
+{
+    avr_cycle_count_t end = avr->cycle + timeout;
+    while (!condition())
+    {
+        if (avr->cycle > end)
+            fail(message);
+
+        int state = avr_run(avr);
+        if (state == cpu_Done || state == cpu_Crashed)
+            fail("firmware stopped");
+    }
+}
+
+static bool is_relay_enabled(void)
+{
+    return relay_enabled;
+}
+
+static bool is_relay_disabled(void)
+{
+    return !relay_enabled;
+}
+
+static uint8_t heartbeat_lease;
+
+static bool lease_decremented(void)
+{
+    return avr->data[leases_address] != heartbeat_lease;
+}
+
+static void check_time(const char *event, avr_cycle_count_t actual, avr_cycle_count_t expected)
+{
+    long long error = (long long)actual - (long long)expected;
+    printf("%-28s %10.6f s (%+lld cycles)\n", event, (double)actual / F_CPU, error);
+    if (llabs(error) > TOLERANCE_CYCLES)
+        fail(event);
+}
+
+// Set lease 0 and return the cycle of the next timer1 tick
+static avr_cycle_count_t arm_heartbeat(uint8_t timeout)
+{
+    heartbeat_lease = timeout;
+    avr->data[leases_address] = timeout;
+    run_until(lease_decremented, TICK_CYCLES + TOLERANCE_CYCLES, "heartbeat was not counted down");
+    return avr->cycle;
+}
+
+// The heartbeat must trip on the tick that its lease expires, and the
+// dome must be sent one command per tick until both shutters report closed
+// This expects the build options set by the Makefile: HAS_BUMPER_GUARD = 1,
+// CLOSE_B_FIRST = 1, and CLOSE_INTERLEAVED = 0
+static void scenario_close(void)
+{
+    static const char expected[] = "RRRRBBBAAA";
+    const int expected_length = sizeof(expected) - 1;
+
+    avr_cycle_count_t tick = arm_heartbeat(5);
+    run_until(is_relay_enabled, 5 * TICK_CYCLES, "heartbeat did not trip");
+
+    avr_cycle_count_t tripped = relay_changed_cycle;
+    check_time("relay enabled", tripped, tick + 4 * TICK_CYCLES);
+
+    run_until(is_relay_disabled, (expected_length + 1) * TICK_CYCLES, "dome was not released");
+    check_time("relay released", relay_changed_cycle, tripped + expected_length * TICK_CYCLES);
+
+    if (dome_log_length != expected_length || memcmp(dome_log, expected, expected_length) != 0)
+    {
+        printf("sent %.*s, expected %s\n", dome_log_length, dome_log, expected);
+        fail("unexpected close commands");
+    }
+
+    for (int i = 0; i < expected_length; i++)
+    {
+        char event[32];
+        snprintf(event, sizeof(event), "command %d (%c)", i + 1, dome_log[i]);
+        check_time(event, dome_log_cycles[i], tripped + i * TICK_CYCLES);
+    }
+
+    if (!avr->data[triggered_address])
+        fail("status was not left at 255");
+}
+
+static void set_fast_close(bool asserted)
+{
+    avr_raise_irq(fast_close_input, asserted ? 0 : 1);
+}
+
+// Asserting the input while the heartbeat is armed must close the dome once it has been debounced
+static void scenario_fast_close(void)
+{
+    arm_heartbeat(240);
+    run_for(MS_CYCLES(100));
+
+    avr_cycle_count_t asserted = avr->cycle;
+    set_fast_close(true);
+    run_until(is_relay_enabled, MS_CYCLES(2), "fast-close input did not trip");
+
+    // The debounce is measured in whole timer1 clocks from wherever the timer is
+    avr_cycle_count_t delay = relay_changed_cycle - asserted;
+    printf("%-28s %10.6f ms\n", "relay enabled after", (double)delay * 1000 / F_CPU);
+    if (delay < DEBOUNCE_CYCLES - 1024 || delay > DEBOUNCE_CYCLES + TOLERANCE_CYCLES)
+        fail("fast-close input was not debounced for 0.5 ms");
+
+    // The first command is sent straight away instead of on the next tick
+    run_for(MS_CYCLES(1));
+    if (dome_log_length == 0)
+        fail("close did not start immediately");
+
+    if (!avr->data[triggered_address])
+        fail("status was not set to 255");
+}
+
+// Pulses shorter than the debounce must be ignored, and
+// a bouncing input must only trip once it has settled
+static void scenario_fast_close_bounce(void)
+{
+    arm_heartbeat(240);
+    run_for(MS_CYCLES(100));
+
+    set_fast_close(true);
+    run_for(US_CYCLES(200));
+    set_fast_close(false);
+    run_for(MS_CYCLES(1000));
+    if (relay_enabled)
+        fail("tripped on a 0.2 ms pulse");
+
+    // Bounce every 0.1 ms for 5 ms before settling
+    for (int i = 0; i < 50; i++)
+    {
+        set_fast_close(i % 2 == 0);
+        run_for(US_CYCLES(100));
+        if (relay_enabled)
+            fail("tripped while the input was bouncing");
+    }
+
+    avr_cycle_count_t settled = avr->cycle;
+    set_fast_close(true);
+    run_until(is_relay_enabled, MS_CYCLES(2), "fast-close input did not trip after settling");
+    if (relay_changed_cycle - settled < DEBOUNCE_CYCLES - 1024)
+        fail("tripped before the input had settled");
+}
+
+// An input that is already asserted when the heartbeat is armed has
+// no edge to trigger on, so must be found by the timer1 tick
+static void scenario_fast_close_held(void)
+{
+    set_fast_close(true);
+    run_for(MS_CYCLES(2000));
+    if (relay_enabled)
+        fail("tripped while the heartbeat was disabled");
+
+    avr_cycle_count_t tick = arm_heartbeat(240);
+    run_until(is_relay_enabled, TICK_CYCLES, "held fast-close input did not trip");
+    check_time("relay enabled", relay_changed_cycle, tick + DEBOUNCE_CYCLES);
+
+    if (!avr->data[triggered_address])
+        fail("status was not set to 255");
+}
+
+static bool is_lease_restored(void)
+{
+    return avr->data[leases_address] != 0;
+}
+
+// Reset the firmware, optionally losing the state mirror in RAM as
+// a power cycle would, and return the cycle that the reset happened on
+static avr_cycle_count_t reset_firmware(bool lose_mirror)
+{
+    avr_reset(avr);
+
+    // The reset leaves the relay pin as an input, which releases the relay
+    relay_enabled = false;
+
+    // The C runtime clears the leases before the firmware restores them
+    avr->data[leases_address] = 0;
+    if (lose_mirror)
+    {
+        avr->data[state_mirror_checksum_address] ^= 0xFF;
+        avr->data[state_mirror_checksum_address + 1] ^= 0xFF;
+    }
+
+    return avr->cycle;
+}
+
+static void check_boot_time(const char *event, avr_cycle_count_t cycles)
+{
+    printf("%-28s %10.6f ms (%llu cycles)\n", event, (double)cycles * 1000 / F_CPU, (unsigned long long)cycles);
+    if (cycles > MS_CYCLES(5))
+        fail("protection was not restored within 5 ms of the reset");
+}
+
+// The heartbeat and an interrupted close must be restored within a few
+// milliseconds of a reset, before USB has been started, from the state
+// mirror in RAM or (if that was lost) from EEPROM
+static void scenario_boot(void)
+{
+    // The lease timeout is saved to EEPROM by the main loop
+    avr->data[lease_timeouts_address] = 240;
+    arm_heartbeat(240);
+    run_for(MS_CYCLES(100));
+
+    avr_cycle_count_t reset = reset_firmware(false);
+    run_until(is_lease_restored, MS_CYCLES(100), "lease was not restored from RAM");
+    check_boot_time("lease restored from RAM", avr->cycle - reset);
+
+    reset = reset_firmware(true);
+    run_until(is_lease_restored, MS_CYCLES(100), "lease was not restored from EEPROM");
+    check_boot_time("lease restored from EEPROM", avr->cycle - reset);
+    if (avr->data[leases_address] != 240)
+        fail("lease was not restarted with its full timeout");
+
+    // Interrupt the close, which must switch the relay back on straight away
+    arm_heartbeat(2);
+    run_until(is_relay_enabled, 2 * TICK_CYCLES, "heartbeat did not trip");
+    run_for(2 * TICK_CYCLES);
+
+    reset = reset_firmware(false);
+    run_until(is_relay_enabled, MS_CYCLES(100), "close was not resumed from RAM");
+    check_boot_time("close resumed from RAM", relay_changed_cycle - reset);
+
+    reset = reset_firmware(true);
+    run_until(is_relay_enabled, MS_CYCLES(100), "close was not restarted from EEPROM");
+    check_boot_time("close restarted from EEPROM", relay_changed_cycle - reset);
+}
+
+// Print the deepest that the stack has reached, as memory_stack_usage() would report it,
+// failing if it has reached the static variables
+static void report_stack_usage(void)
+{
+    uint16_t address = end_address;
+    while (address <= stack_address && avr->data[address] == STACK_CANARY)
+        address++;
+
+    uint16_t never_used = address - end_address;
+    printf("%-28s %4u bytes (%u never used)\n", "stack high-water", stack_address - address + 1, never_used);
+    if (never_used == 0)
+        fail("stack reached the static variables");
+}
+
+typedef struct
+{
+    const char *name;
+    void (*run)(void);
+} scenario_t;
+
+static const scenario_t scenarios[] =
+{
+    { "close", scenario_close },
+    { "fast-close", scenario_fast_close },
+    { "fast-close-bounce", scenario_fast_close_bounce },
+    { "fast-close-held", scenario_fast_close_held },
+    { "boot", scenario_boot },
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s <main.elf> <scenario>\n", argv[0]);
+        return 2;
+    }
+
+    const scenario_t *scenario = NULL;
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        if (strcmp(argv[2], scenarios[i].name) == 0)
+            scenario = &scenarios[i];
+
+    if (!scenario)
+    {
+        fprintf(stderr, "unknown scenario %s\n", argv[2]);
+        return 2;
+    }
+
+    elf_firmware_t firmware;
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(argv[1], &firmware) != 0)
+    {
+        fprintf(stderr, "unable to load %s\n", argv[1]);
+        return 2;
+    }
+
+    leases_address = find_symbol(argv[1], "leases");
+    lease_timeouts_address = find_symbol(argv[1], "lease_timeouts");
+    triggered_address = find_symbol(argv[1], "triggered");
+    state_mirror_checksum_address = find_symbol(argv[1], "state_mirror_checksum");
+    end_address = find_symbol(argv[1], "_end");
+    stack_address = find_symbol(argv[1], "__stack");
+
+    avr = avr_make_mcu_by_name("atmega32u4");
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+    avr->frequency = F_CPU;
+
+    // Connect the simulated dome to USART1 instead of simavr's console output
+    uint32_t flags = 0;
+    avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('1'), &flags);
+    flags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('1'), &flags);
+
+    dome_input = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('1'), UART_IRQ_INPUT);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('1'), UART_IRQ_OUTPUT), dome_receive, NULL);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), 6), relay_changed, NULL);
+
+    // The rain sensor contact starts open, leaving the input pulled up
+    fast_close_input = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 4);
+    set_fast_close(false);
+
+    // Let the firmware start up
+    run_for(MS_CYCLES(10));
+
+    printf("%s:\n", scenario->name);
+    scenario->run();
+    report_stack_usage();
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,146 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+// Host stand-in for the parts of LUFA's <LUFA/Drivers/USB/USB.h> that storage.c uses
+// The types and constants match LUFA's, and the endpoint functions are provided by
+// the test, which models the selected IN endpoint and the host reading from it
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef HOST_LUFA_USB_H
+#define HOST_LUFA_USB_H
+
+#define ATTR_PACKED __attribute__((packed))
+
+#define SCSI_CMD_INQUIRY                               0x12
+#define SCSI_CMD_REQUEST_SENSE                         0x03
+#define SCSI_CMD_TEST_UNIT_READY                       0x00
+#define SCSI_CMD_READ_CAPACITY_10                      0x25
+#define SCSI_CMD_START_STOP_UNIT                       0x1B
+#define SCSI_CMD_SEND_DIAGNOSTIC                       0x1D
+#define SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL          0x1E
+#define SCSI_CMD_WRITE_10                              0x2A
+#define SCSI_CMD_READ_10                               0x28
+#define SCSI_CMD_VERIFY_10                             0x2F
+#define SCSI_CMD_MODE_SENSE_6                          0x1A
+
+#define SCSI_SENSE_KEY_GOOD                            0x00
+#define SCSI_SENSE_KEY_ILLEGAL_REQUEST                 0x05
+#define SCSI_SENSE_KEY_DATA_PROTECT                    0x07
+#define SCSI_SENSE_KEY_ABORTED_COMMAND                 0x0B
+
+#define SCSI_ASENSE_NO_ADDITIONAL_INFORMATION          0x00
+#define SCSI_ASENSE_INVALID_FIELD_IN_CDB               0x24
+#define SCSI_ASENSE_WRITE_PROTECTED                    0x27
+#define SCSI_ASENSE_INVALID_COMMAND                    0x20
+#define SCSI_ASENSE_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE 0x21
+
+#define SCSI_ASENSEQ_NO_QUALIFIER                      0x00
+
+enum Endpoint_WaitUntilReady_ErrorCodes_t
+{
+    ENDPOINT_READYWAIT_NoError            = 0,
+    ENDPOINT_READYWAIT_EndpointStalled    = 1,
+    ENDPOINT_READYWAIT_DeviceDisconnected = 2,
+    ENDPOINT_READYWAIT_BusSuspended       = 3,
+    ENDPOINT_READYWAIT_Timeout            = 4,
+    ENDPOINT_READYWAIT_Aborted            = 6,
+};
+
+typedef struct
+{
+    uint8_t  ResponseCode;
+
+    uint8_t  SegmentNumber;
+
+    unsigned SenseKey            : 4;
+    unsigned Reserved            : 1;
+    unsigned ILI                 : 1;
+    unsigned EOM                 : 1;
+    unsigned FileMark            : 1;
+
+    uint8_t  Information[4];
+    uint8_t  AdditionalLength;
+    uint8_t  CmdSpecificInformation[4];
+    uint8_t  AdditionalSenseCode;
+    uint8_t  AdditionalSenseQualifier;
+    uint8_t  FieldReplaceableUnitCode;
+    uint8_t  SenseKeySpecific[3];
+} ATTR_PACKED SCSI_Request_Sense_Response_t;
+
+typedef struct
+{
+    unsigned DeviceType          : 5;
+    unsigned PeripheralQualifier : 3;
+
+    unsigned Reserved            : 7;
+    unsigned Removable           : 1;
+
+    uint8_t  Version;
+
+    unsigned ResponseDataFormat  : 4;
+    unsigned Reserved2           : 1;
+    unsigned NormACA             : 1;
+    unsigned TrmTsk              : 1;
+    unsigned AERC                : 1;
+
+    uint8_t  AdditionalLength;
+    uint8_t  Reserved3[2];
+
+    unsigned SoftReset           : 1;
+    unsigned CmdQue              : 1;
+    unsigned Reserved4           : 1;
+    unsigned Linked              : 1;
+    unsigned Sync                : 1;
+    unsigned WideBus16Bit        : 1;
+    unsigned WideBus32Bit        : 1;
+    unsigned RelAddr             : 1;
+
+    uint8_t  VendorID[8];
+    uint8_t  ProductID[16];
+    uint8_t  RevisionID[4];
+} ATTR_PACKED SCSI_Inquiry_Response_t;
+
+typedef struct
+{
+    uint32_t Signature;
+    uint32_t Tag;
+    uint32_t DataTransferLength;
+    uint8_t  Flags;
+    uint8_t  LUN;
+    uint8_t  SCSICommandLength;
+    uint8_t  SCSICommandData[16];
+} ATTR_PACKED MS_CommandBlockWrapper_t;
+
+typedef struct
+{
+    struct
+    {
+        struct
+        {
+            uint8_t Address;
+        } DataINEndpoint;
+    } Config;
+
+    struct
+    {
+        MS_CommandBlockWrapper_t CommandBlock;
+        volatile bool IsMassStoreReset;
+    } State;
+} USB_ClassInfo_MS_Device_t;
+
+void Endpoint_SelectEndpoint(uint8_t address);
+bool Endpoint_IsReadWriteAllowed(void);
+void Endpoint_ClearIN(void);
+void Endpoint_Write_8(uint8_t data);
+uint8_t Endpoint_WaitUntilReady_Bounded(uint16_t timeout_ms, bool (*abort_check)(void));
+uint8_t Endpoint_Write_Stream_LE(const void *buffer, uint16_t length, uint16_t *bytes_processed);
+uint8_t Endpoint_Write_PStream_LE(const void *buffer, uint16_t length, uint16_t *bytes_processed);
+uint8_t Endpoint_Null_Stream(uint16_t length, uint16_t *bytes_processed);
+
+#endif
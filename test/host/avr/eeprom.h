@@ -0,0 +1,40 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+// Host stand-in for avr-libc's <avr/eeprom.h>
+// EEMEM variables are plain variables, which the tests keep across a simulated reset
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#define EEMEM
+
+static inline uint8_t eeprom_read_byte(const uint8_t *address)
+{
+    return *address;
+}
+
+static inline void eeprom_update_byte(uint8_t *address, uint8_t value)
+{
+    *address = value;
+}
+
+static inline void eeprom_read_block(void *data, const void *address, size_t length)
+{
+    memcpy(data, address, length);
+}
+
+static inline void eeprom_update_block(const void *data, void *address, size_t length)
+{
+    memcpy(address, data, length);
+}
+
+#endif
@@ -0,0 +1,22 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+// Host stand-in for avr-libc's <avr/interrupt.h>
+// Each ISR is a plain function that the tests call to raise the interrupt
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+// Interrupts are only ever raised by the tests, so there is nothing to disable
+// Enabling them is reported to the test, which uses it to find the end of main()'s setup
+void host_sei(void);
+#define sei() host_sei()
+#define cli()
+
+#endif
@@ -0,0 +1,121 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+// Host stand-in for avr-libc's <avr/io.h>, used by the host tests
+// The ATmega32u4 registers that the firmware uses are plain variables,
+// which the tests set and check instead of the hardware
+
+#include <stdint.h>
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#ifdef HOST_DEFINE_REGISTERS
+#define REGISTER(type, name) volatile type name
+#else
+#define REGISTER(type, name) extern volatile type name
+#endif
+
+#define _BV(bit) (1 << (bit))
+
+#define FLASHEND 0x7FFF
+#define RAMEND   0x0AFF
+#define E2END    0x03FF
+
+REGISTER(uint8_t, PINB);
+REGISTER(uint8_t, DDRB);
+REGISTER(uint8_t, PORTB);
+REGISTER(uint8_t, PINC);
+REGISTER(uint8_t, DDRC);
+REGISTER(uint8_t, PORTC);
+REGISTER(uint8_t, PIND);
+REGISTER(uint8_t, DDRD);
+REGISTER(uint8_t, PORTD);
+REGISTER(uint8_t, PINE);
+REGISTER(uint8_t, DDRE);
+REGISTER(uint8_t, PORTE);
+
+REGISTER(uint8_t, PCICR);
+REGISTER(uint8_t, PCMSK0);
+
+REGISTER(uint8_t, TCCR1A);
+REGISTER(uint8_t, TCCR1B);
+REGISTER(uint8_t, TIMSK1);
+REGISTER(uint8_t, TIFR1);
+REGISTER(uint16_t, TCNT1);
+REGISTER(uint16_t, OCR1A);
+REGISTER(uint16_t, OCR1B);
+
+REGISTER(uint8_t, TCCR4A);
+REGISTER(uint8_t, TCCR4B);
+REGISTER(uint8_t, TCCR4D);
+REGISTER(uint8_t, TIMSK4);
+REGISTER(uint8_t, TC4H);
+REGISTER(uint8_t, TCNT4);
+REGISTER(uint8_t, OCR4A);
+REGISTER(uint8_t, OCR4C);
+
+REGISTER(uint8_t, TWBR);
+REGISTER(uint8_t, TWSR);
+REGISTER(uint8_t, TWCR);
+REGISTER(uint8_t, TWDR);
+
+// Port bits
+#define PB2    2
+#define PB4    4
+#define DDB2   2
+#define DDB4   4
+#define PINB4  4
+#define PC6    6
+#define PC7    7
+#define DDC6   6
+#define DDC7   7
+#define PD0    0
+#define PD1    1
+#define PD4    4
+#define PD7    7
+#define DDD4   4
+#define DDD7   7
+#define PE6    6
+#define DDE6   6
+
+// Pin change interrupt bits
+#define PCIE0  0
+#define PCINT4 4
+
+// Timer1 bits
+#define CS10   0
+#define CS11   1
+#define CS12   2
+#define WGM12  3
+#define OCIE1A 1
+#define OCIE1B 2
+#define OCF1A  1
+#define OCF1B  2
+
+// Timer4 bits
+#define CS40   0
+#define CS41   1
+#define CS42   2
+#define CS43   3
+#define PWM4A  1
+#define TOIE4  2
+#define COM4A0 6
+#define COM4A1 7
+
+// TWI bits
+#define TWIE   0
+#define TWEN   2
+#define TWWC   3
+#define TWSTO  4
+#define TWSTA  5
+#define TWEA   6
+#define TWINT  7
+#define TWPS0  0
+#define TWPS1  1
+
+#endif
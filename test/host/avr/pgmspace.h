@@ -0,0 +1,26 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+// Host stand-in for avr-libc's <avr/pgmspace.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(address)  (*(const uint8_t *)(address))
+// Words are read at the type they point to, which keeps the function pointers
+// in flash tables whole (they are wider than a word on the host)
+#define pgm_read_word(address)  (*(address))
+#define pgm_read_dword(address) (*(const uint32_t *)(address))
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+#endif
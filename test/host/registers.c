@@ -0,0 +1,11 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+// Defines the register variables declared by the host <avr/io.h>
+
+#define HOST_DEFINE_REGISTERS
+#include <avr/io.h>
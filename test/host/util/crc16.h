@@ -0,0 +1,24 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+// Host stand-in for avr-libc's <util/crc16.h>, with the same CRC-16 (0xA001) polynomial
+
+#include <stdint.h>
+
+#ifndef HOST_UTIL_CRC16_H
+#define HOST_UTIL_CRC16_H
+
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t a)
+{
+    crc ^= a;
+    for (uint8_t i = 0; i < 8; i++)
+        crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+
+    return crc;
+}
+
+#endif
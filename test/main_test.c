@@ -0,0 +1,1176 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+// Builds main.c for the host and runs it against a simulated dome, USB host and
+// fast-close input. The registers are plain variables (see host/avr/io.h), and the
+// timer1 tick, pin change and debounce interrupts are raised by calling their ISRs,
+// so this checks the firmware's logic tick by tick. The cycle timing within each
+// tick is checked by harness.c in simavr.
+
+#include <setjmp.h>
+#include <stdlib.h>
+
+#define main firmware_main
+#include "../main.c"
+#undef main
+
+// Number of steps that the simulated dome needs to close each shutter
+#define DOME_CLOSE_STEPS 3
+
+// Bytes received by the simulated dome, with the tick that each was sent on
+#define DOME_LOG_SIZE 1024
+static uint8_t dome_log[DOME_LOG_SIZE];
+static unsigned long dome_log_ticks[DOME_LOG_SIZE];
+static int dome_log_length = 0;
+
+// Steps remaining until each shutter of the simulated dome is closed,
+// and the tick that the step which closed the second of them was sent on
+static int dome_a_steps = DOME_CLOSE_STEPS;
+static int dome_b_steps = DOME_CLOSE_STEPS;
+static unsigned long dome_closed_tick = 0;
+
+// Replies from the dome become readable on the tick after the step that caused them,
+// or (chosen at random for each reply) up to this many ticks later
+static unsigned long dome_latency = 0;
+
+// Chance (in percent) that each byte sent to or from the dome is lost
+static int dome_drop_percent = 0;
+
+// Bytes sent by the dome, which the firmware can read from the tick in ready_tick
+#define DOME_REPLY_SIZE 256
+typedef struct
+{
+    uint8_t value;
+    unsigned long ready_tick;
+} dome_reply_t;
+
+static dome_reply_t dome_replies[DOME_REPLY_SIZE];
+static int dome_replies_read = 0;
+static int dome_replies_write = 0;
+
+// Replies that have reached the monitor, and so have been seen by its sniffer
+static int dome_replies_arrived = 0;
+
+// Set while a capture is replayed, which takes the place of the simulated dome
+static bool replaying = false;
+
+// Bytes sent by the simulated USB host, and the bytes that it has received
+#define USB_BUFFER_SIZE 4096
+static uint8_t usb_input[USB_BUFFER_SIZE];
+static int usb_input_read = 0;
+static int usb_input_length = 0;
+static uint8_t usb_output[USB_BUFFER_SIZE];
+static int usb_output_length = 0;
+
+// Writes fail while the simulated host has the port closed
+static bool usb_port_open = true;
+
+// Everything that the simulated host has received while capturing,
+// which is what tools/sniffer_decode.py --save would have saved
+#define CAPTURE_SIZE 65536
+static uint8_t capture[CAPTURE_SIZE];
+static int capture_length = 0;
+static bool capturing = false;
+
+// Set when the simulated host opens or closes the port
+static bool usb_line_changed = false;
+
+static unsigned long tick_count = 0;
+
+// Relay state (PC6) as of the last check, with the tick that it last changed on
+static bool relay_enabled = false;
+static unsigned long relay_changed_tick = 0;
+
+// main() is run until it enables interrupts, which then returns here
+static jmp_buf boot_finished;
+
+static void fail(const char *message)
+{
+    printf("FAIL: %s (at tick %lu)\n", message, tick_count);
+    exit(1);
+}
+
+static bool dome_drops_byte(void)
+{
+    return dome_drop_percent > 0 && rand() % 100 < dome_drop_percent;
+}
+
+static void dome_reply(uint8_t value)
+{
+    if (dome_drops_byte())
+        return;
+
+    dome_replies[dome_replies_write].value = value;
+    dome_replies[dome_replies_write].ready_tick = tick_count + 1 + rand() % (dome_latency + 1);
+    dome_replies_write = (dome_replies_write + 1) % DOME_REPLY_SIZE;
+}
+
+// Simulated dome: each step command moves its shutter, and the shutter
+// reports that it is closed in reply to every step once it is closed
+static void dome_receive(uint8_t value)
+{
+    if (dome_log_length < DOME_LOG_SIZE)
+    {
+        dome_log[dome_log_length] = value;
+        dome_log_ticks[dome_log_length++] = tick_count;
+    }
+
+    if (dome_drops_byte())
+        return;
+
+    if (value == 'A')
+    {
+        if (dome_a_steps > 0)
+            dome_a_steps--;
+        if (dome_a_steps == 0)
+            dome_reply('X');
+    }
+
+    if (value == 'B')
+    {
+        if (dome_b_steps > 0)
+            dome_b_steps--;
+        if (dome_b_steps == 0)
+            dome_reply('Y');
+    }
+
+    if (dome_a_steps == 0 && dome_b_steps == 0 && dome_closed_tick == 0)
+        dome_closed_tick = tick_count;
+}
+
+void serial_initialize(void) { }
+
+bool serial_can_read(void)
+{
+    return dome_replies_read != dome_replies_write && dome_replies[dome_replies_read].ready_tick <= tick_count;
+}
+
+uint8_t serial_read(void)
+{
+    uint8_t value = dome_replies[dome_replies_read].value;
+    dome_replies_read = (dome_replies_read + 1) % DOME_REPLY_SIZE;
+    return value;
+}
+
+// Bytes sent by the monitor while replaying, until they are matched to the capture
+static uint8_t replay_sent[DOME_REPLY_SIZE];
+static int replay_sent_read = 0;
+static int replay_sent_write = 0;
+
+// The dome only hears the monitor while the relay connects it to the Arduino,
+// but the sniffer sees every byte that is sent
+void serial_write(uint8_t b)
+{
+    sniffer_record(SNIFFER_TO_DOME, b);
+    if (replaying)
+    {
+        replay_sent[replay_sent_write] = b;
+        replay_sent_write = (replay_sent_write + 1) % DOME_REPLY_SIZE;
+    }
+    else if (PORTC & _BV(PC6))
+        dome_receive(b);
+}
+
+uint8_t serial_write_space(void)
+{
+    return 0xFF;
+}
+
+void serial_discard_input(void)
+{
+    dome_replies_read = dome_replies_write;
+}
+
+void serial_discard_output(void) { }
+
+void usb_initialize(void) { }
+
+uint8_t usb_read_data(uint8_t *data, uint8_t length)
+{
+    uint8_t count = 0;
+    while (count < length && usb_input_read < usb_input_length)
+        data[count++] = usb_input[usb_input_read++];
+
+    return count;
+}
+
+// Only the most recent output is kept, which is enough for the tests to check the status
+bool usb_write_data(const uint8_t *data, uint16_t length)
+{
+    if (!usb_port_open)
+        return false;
+
+    for (uint16_t i = 0; i < length; i++)
+    {
+        if (usb_output_length == USB_BUFFER_SIZE)
+            usb_output_length = 0;
+
+        usb_output[usb_output_length++] = data[i];
+        if (capturing && capture_length < CAPTURE_SIZE)
+            capture[capture_length++] = data[i];
+    }
+
+    return true;
+}
+
+// Only the status bytes are sent by usb_write
+static uint8_t status_sent = 0;
+static unsigned long statuses_sent = 0;
+
+bool usb_write(uint8_t b)
+{
+    if (!usb_write_data(&b, 1))
+        return false;
+
+    status_sent = b;
+    statuses_sent++;
+    return true;
+}
+
+bool usb_line_state_changed(void)
+{
+    bool changed = usb_line_changed;
+    usb_line_changed = false;
+    return changed;
+}
+
+uint16_t memory_static_usage(void) { return 0; }
+uint16_t memory_stack_usage(void) { return 0; }
+uint16_t memory_never_used(void) { return 0; }
+
+void host_sei(void)
+{
+    longjmp(boot_finished, 1);
+}
+
+static void update_relay(void)
+{
+    bool enabled = PORTC & _BV(PC6);
+    if (enabled == relay_enabled)
+        return;
+
+    relay_enabled = enabled;
+    relay_changed_tick = tick_count;
+}
+
+// Clear the RAM and registers as a reset would, except for the .noinit
+// state mirror and the EEPROM, then run main() until it enables interrupts
+static void reset(void)
+{
+    memset((void *)leases, 0, sizeof(leases));
+    expired_leases = 0;
+    active = triggered = false;
+    shutter_a_close_steps = shutter_b_close_steps = 0;
+    relay_reset_steps = enable_siren_steps = 0;
+    shutter_a_sent_steps = shutter_b_sent_steps = 0;
+    shutter_a_confirmed = shutter_b_confirmed = false;
+    shutter_a_learned_steps = shutter_b_learned_steps = 0;
+    calibration_changed = false;
+    memset(lease_timeouts, 0, sizeof(lease_timeouts));
+    memset(&saved_state, 0, sizeof(saved_state));
+    pending_command = pending_arg_count = pending_arg_length = pending_command_ticks = 0;
+    send_status_byte = false;
+    memset((void *)stats, 0, sizeof(stats));
+
+    PORTB = DDRB = PORTC = DDRC = PORTD = DDRD = PORTE = DDRE = 0;
+    PCICR = PCMSK0 = TCCR1A = TCCR1B = TIMSK1 = TIFR1 = 0;
+    TCNT1 = OCR1A = OCR1B = 0;
+    TCCR4A = TCCR4B = TCCR4D = TIMSK4 = 0;
+
+    // The rain sensor contact starts open, leaving the input pulled up
+    PINB = _BV(PINB4);
+
+    if (setjmp(boot_finished) == 0)
+        firmware_main();
+
+    update_relay();
+}
+
+// Replies reach the monitor during the tick before they can be read
+static void dome_replies_arrive(void)
+{
+    while (dome_replies_arrived != dome_replies_write && dome_replies[dome_replies_arrived].ready_tick <= tick_count + 1)
+    {
+        sniffer_record(SNIFFER_FROM_DOME, dome_replies[dome_replies_arrived].value);
+        dome_replies_arrived = (dome_replies_arrived + 1) % DOME_REPLY_SIZE;
+    }
+}
+
+// Raise the timer1 interrupt, then run the main loop once
+static void tick(void)
+{
+    tick_count++;
+    TIMER1_COMPA_vect();
+    update_relay();
+    poll_usb();
+    dome_replies_arrive();
+}
+
+static void run_ticks(unsigned long count)
+{
+    for (unsigned long i = 0; i < count; i++)
+        tick();
+}
+
+// Run until the condition is true, failing if it takes longer than timeout ticks
+static void run_until(bool (*condition)(void), unsigned long timeout, const char *message)
+{
+    unsigned long end = tick_count + timeout;
+    while (!condition())
+    {
+        if (tick_count >= end)
+            fail(message);
+
+        tick();
+    }
+}
+
+static bool is_relay_enabled(void)
+{
+    return relay_enabled;
+}
+
+static bool is_relay_disabled(void)
+{
+    return !relay_enabled;
+}
+
+// Send bytes from the USB host, which are handled by the next pass of the main loop
+static void usb_send(const uint8_t *data, int length)
+{
+    if (usb_input_read == usb_input_length)
+        usb_input_read = usb_input_length = 0;
+
+    for (int i = 0; i < length; i++)
+        usb_input[usb_input_length++] = data[i];
+}
+
+static void usb_send_byte(uint8_t value)
+{
+    usb_send(&value, 1);
+}
+
+static uint8_t last_status(void)
+{
+    if (usb_output_length == 0)
+        fail("no status was sent");
+
+    return usb_output[usb_output_length - 1];
+}
+
+static void check_tick(const char *event, unsigned long actual, unsigned long expected)
+{
+    printf("%-28s tick %4lu (%+ld)\n", event, actual, (long)actual - (long)expected);
+    if (actual != expected)
+        fail(event);
+}
+
+// Send a heartbeat ping and return the tick that it is handled on
+static unsigned long arm_heartbeat(uint8_t timeout)
+{
+    usb_send_byte(timeout);
+    poll_usb();
+    if (heartbeat_remaining() != timeout)
+        fail("heartbeat was not armed");
+
+    return tick_count;
+}
+
+static void set_fast_close(bool asserted)
+{
+    if (asserted)
+        PINB &= ~_BV(PINB4);
+    else
+        PINB |= _BV(PINB4);
+
+#if FAST_CLOSE_INPUT
+    PCINT0_vect();
+    update_relay();
+#endif
+}
+
+// The heartbeat must trip on the tick that its lease expires, and the
+// dome must be sent one command per tick until both shutters report closed
+// This expects the build options set by the Makefile: HAS_BUMPER_GUARD = 1,
+// CLOSE_B_FIRST = 1, and CLOSE_INTERLEAVED = 0
+static void scenario_close(void)
+{
+    static const char expected[] = "RRRRBBBAAA";
+    const int expected_length = sizeof(expected) - 1;
+
+    unsigned long armed = arm_heartbeat(5);
+    run_until(is_relay_enabled, 10, "heartbeat did not trip");
+
+    unsigned long tripped = relay_changed_tick;
+    check_tick("relay enabled", tripped, armed + 5);
+    if (last_status() != 254)
+        fail("status was not 254 while closing");
+
+    run_until(is_relay_disabled, expected_length + 1, "dome was not released");
+    check_tick("relay released", relay_changed_tick, tripped + expected_length);
+
+    if (dome_log_length != expected_length || memcmp(dome_log, expected, expected_length) != 0)
+    {
+        printf("sent %.*s, expected %s\n", dome_log_length, dome_log, expected);
+        fail("unexpected close commands");
+    }
+
+    for (int i = 0; i < expected_length; i++)
+    {
+        char event[32];
+        snprintf(event, sizeof(event), "command %d (%c)", i + 1, dome_log[i]);
+        check_tick(event, dome_log_ticks[i], tripped + i);
+    }
+
+    if (last_status() != 255)
+        fail("status was not left at 255");
+}
+
+// Clear the sticky 255 state, and reopen the simulated dome with each shutter
+// needing the given number of steps to close
+static void reopen_dome(int a_steps, int b_steps)
+{
+    usb_send_byte(0);
+    tick();
+    if (last_status() != 0)
+        fail("status was not cleared");
+
+    dome_a_steps = a_steps;
+    dome_b_steps = b_steps;
+    dome_closed_tick = 0;
+    dome_log_length = 0;
+}
+
+// Count the step commands that were sent to a shutter
+static int count_steps(uint8_t command)
+{
+    int count = 0;
+    for (int i = 0; i < dome_log_length; i++)
+        if (dome_log[i] == command)
+            count++;
+
+    return count;
+}
+
+// Close the dome, returning the number of ticks that the relay was enabled for
+static unsigned long close_dome(void)
+{
+    arm_heartbeat(1);
+    run_until(is_relay_enabled, 2, "heartbeat did not trip");
+    unsigned long tripped = relay_changed_tick;
+    run_until(is_relay_disabled, 4 * MAX_SHUTTER_CLOSE_STEPS, "dome was not released");
+    return relay_changed_tick - tripped;
+}
+
+// A shutter that needs more steps than its learned budget (the learned steps plus
+// CLOSE_STEP_MARGIN) must still be closed, and then be learned again
+static void scenario_slow_shutter(void)
+{
+    close_dome();
+    printf("%-28s A %d, B %d\n", "learned steps", shutter_a_learned_steps, shutter_b_learned_steps);
+    if (shutter_a_learned_steps != DOME_CLOSE_STEPS || shutter_b_learned_steps != DOME_CLOSE_STEPS)
+        fail("close steps were not learned");
+
+    const int slow_steps = DOME_CLOSE_STEPS + CLOSE_STEP_MARGIN + 3;
+    reopen_dome(DOME_CLOSE_STEPS, slow_steps);
+    unsigned long duration = close_dome();
+
+    printf("%-28s A %d, B %d\n", "steps sent", count_steps('A'), count_steps('B'));
+    printf("%-28s %lu ticks\n", "relay enabled for", duration);
+    if (dome_a_steps != 0 || dome_b_steps != 0)
+        fail("dome was left open");
+
+    if (!shutter_b_confirmed || count_steps('B') != slow_steps)
+        fail("slow shutter was not stepped until it reported closed");
+
+    printf("%-28s A %d, B %d\n", "learned steps", shutter_a_learned_steps, shutter_b_learned_steps);
+    if (shutter_a_learned_steps != DOME_CLOSE_STEPS || shutter_b_learned_steps != slow_steps)
+        fail("slow shutter was not learned again");
+
+    // The calibration is saved by the main loop
+    if (shutter_b_learned_steps_eeprom != slow_steps)
+        fail("slow shutter calibration was not saved");
+
+    // A shutter that never reports closed is sent the full maximum
+    reopen_dome(DOME_CLOSE_STEPS, MAX_SHUTTER_CLOSE_STEPS + 10);
+    close_dome();
+    printf("%-28s A %d, B %d\n", "steps sent", count_steps('A'), count_steps('B'));
+    if (count_steps('B') != MAX_SHUTTER_CLOSE_STEPS || shutter_b_confirmed)
+        fail("stuck shutter was not sent MAX_SHUTTER_CLOSE_STEPS");
+
+    if (shutter_b_learned_steps != 0 || shutter_b_learned_steps_eeprom != 0)
+        fail("stuck shutter calibration was not forgotten");
+}
+
+static void check_leases(const char *event, uint8_t lease_0, uint8_t lease_1, uint8_t lease_2)
+{
+    printf("%-28s %3u %3u %3u %3u\n", event, leases[0], leases[1], leases[2], leases[3]);
+    if (leases[0] != lease_0 || leases[1] != lease_1 || leases[2] != lease_2 || leases[3] != 0)
+        fail(event);
+}
+
+// A multi-byte command must be discarded if its arguments stop arriving
+// or the port is reopened, so that the next client's bytes aren't taken as
+// arguments (here they would otherwise update lease 2 instead of lease 0)
+static void scenario_pending_command(void)
+{
+    arm_heartbeat(100);
+
+    // Arguments split across ticks are accepted
+    usb_send_byte(CMD_PING_LEASE);
+    poll_usb();
+    tick();
+    usb_send_byte(1);
+    poll_usb();
+    tick();
+    usb_send_byte(20);
+    poll_usb();
+    check_leases("split arguments", 98, 20, 0);
+
+    // A command is discarded once a whole tick passes without an argument byte
+    usb_send_byte(CMD_PING_LEASE);
+    poll_usb();
+    run_ticks(2);
+    const uint8_t ping[] = { 2, 2 };
+    usb_send(ping, sizeof(ping));
+    poll_usb();
+    check_leases("arguments timed out", 2, 18, 0);
+
+    // A command is discarded when the port is opened or closed
+    usb_send_byte(CMD_PING_LEASE);
+    poll_usb();
+    usb_line_changed = true;
+    const uint8_t reconnect[] = { 2, 240 };
+    usb_send(reconnect, sizeof(reconnect));
+    poll_usb();
+    check_leases("port reopened", 240, 18, 0);
+
+    // A 0 from the next client clears the sticky 255 state
+    run_until(is_relay_enabled, 20, "heartbeat did not trip");
+    run_until(is_relay_disabled, 20, "dome was not released");
+    usb_send_byte(CMD_PING_LEASE);
+    poll_usb();
+    run_ticks(2);
+    usb_send_byte(0);
+    tick();
+    printf("%-28s %u\n", "status after 0", last_status());
+    if (last_status() != 0)
+        fail("0 was taken as a command argument");
+}
+
+// Simulate a power cycle, which loses the .noinit state mirror
+static void power_cycle(void)
+{
+    memset(&state_mirror, 0x5A, sizeof(state_mirror));
+    reset();
+}
+
+static void check_close_resumed(const char *expected)
+{
+    run_until(is_relay_disabled, 20, "dome was not released");
+    printf("%-28s %.*s\n", "commands sent", dome_log_length, dome_log);
+    if (dome_log_length != (int)strlen(expected) || memcmp(dome_log, expected, dome_log_length) != 0)
+        fail("unexpected close commands");
+
+    if (dome_a_steps != 0 || dome_b_steps != 0)
+        fail("dome was left open");
+
+    // The trip was counted before the reset
+    if (stats[STATS_TRIPS] != 0 || stats[STATS_CLOSES] != 1)
+        fail("trip was counted again");
+
+    tick();
+    if (last_status() != 255)
+        fail("status was not left at 255");
+}
+
+// A reset that keeps the RAM must carry on exactly where it left off
+static void scenario_restore_mirror(void)
+{
+    arm_heartbeat(20);
+    run_ticks(3);
+    reset();
+    check_leases("leases after reset", 17, 0, 0);
+
+    // Interrupt the close after the first B step
+    run_until(is_relay_enabled, 20, "heartbeat did not trip");
+    run_ticks(4);
+    reset();
+
+    // Protection is back before interrupts are enabled, and
+    // the next tick is brought forward to carry on the close
+    printf("%-28s %s\n", "relay enabled at boot", relay_enabled ? "yes" : "no");
+    if (!relay_enabled || !active || TCNT1 != OCR1A - 2)
+        fail("close was not resumed at boot");
+
+    check_close_resumed("RRRRBBBAAA");
+}
+
+// If the mirror was lost the leases and trip state must be restored from EEPROM
+static void scenario_restore_eeprom(void)
+{
+    arm_heartbeat(20);
+    const uint8_t lease[] = { CMD_PING_LEASE, 1, 30 };
+    usb_send(lease, sizeof(lease));
+    run_ticks(3);
+    power_cycle();
+
+    // Each held lease restarts with the timeout it was taken with
+    check_leases("leases after power cycle", 20, 30, 0);
+
+    // An interrupted close restarts from the beginning
+    run_until(is_relay_enabled, 21, "heartbeat did not trip");
+    run_ticks(4);
+    power_cycle();
+
+    printf("%-28s %s\n", "relay enabled at boot", relay_enabled ? "yes" : "no");
+    if (!relay_enabled || !active || TCNT1 != OCR1A - 2)
+        fail("close was not restarted at boot");
+
+    // The first B step before the power cycle moved the shutter
+    check_close_resumed("RRRRBRRRRBBAAA");
+
+    // A sticky 255 state is restored
+    power_cycle();
+    tick();
+    printf("%-28s %u\n", "status after power cycle", last_status());
+    if (!triggered || relay_enabled || last_status() != 255)
+        fail("255 state was not restored");
+}
+
+// Timer1 clocks (64us) in each tick
+#define TICK_CLOCKS 7813
+
+// A sniffer record decoded from a capture, with the tick that it was made during
+typedef struct
+{
+    uint8_t direction;
+    uint8_t value;
+    unsigned long tick;
+} capture_record_t;
+
+// Decode the sniffer records in a capture, skipping the status bytes and
+// command replies between them as tools/sniffer_decode.py does
+// Returns the number of records, or -1 if a record comes before the first sync
+static int decode_capture(const uint8_t *data, int length, capture_record_t *records)
+{
+    int count = 0;
+    long epoch = -1;
+    int i = 0;
+    while (i + 4 <= length)
+    {
+        if (data[i] != SNIFFER_RECORD && data[i] != SNIFFER_SYNC)
+        {
+            i++;
+            continue;
+        }
+
+        uint16_t word = data[i + 2] | (data[i + 3] << 8);
+        if (data[i] == SNIFFER_SYNC)
+            epoch = word;
+        else
+        {
+            if (epoch < 0)
+                return -1;
+
+            // The timestamps count the timer1 clocks in fours, so a record made in the
+            // first 256us of a tick could otherwise be placed in the tick before it.
+            // Records made in the last 256us of a tick are placed in the next one instead,
+            // which is much less likely because the firmware is busiest just after a tick
+            unsigned long clocks = ((((unsigned long)epoch << 14) | (word & 0x3FFF)) << 2) + 3;
+            records[count].direction = word >> 14;
+            records[count].value = data[i + 1];
+            records[count].tick = clocks / TICK_CLOCKS;
+            count++;
+        }
+
+        i += 4;
+    }
+
+    return count;
+}
+
+// Count the bytes sent to the dome during the last tick that the capture doesn't have
+static int replay_unmatched_commands(void)
+{
+    int mismatches = 0;
+    while (replay_sent_read != replay_sent_write)
+    {
+        printf("tick %lu: sent 0x%02X to the dome, which the capture doesn't have\n",
+            tick_count, replay_sent[replay_sent_read]);
+        replay_sent_read = (replay_sent_read + 1) % DOME_REPLY_SIZE;
+        mismatches++;
+    }
+
+    return mismatches;
+}
+
+static int replay_statuses = 0;
+static int replay_commands = 0;
+
+// Feed the bytes from the PC and the dome in a capture to the firmware, a tick at a
+// time, and compare the status bytes and dome commands that it sends with the ones in
+// the capture. The PC bytes are handled by the main loop in the tick that they were
+// recorded in, and the dome bytes are readable by the tick after the one they were
+// recorded in, as they were when the capture was made.
+// Returns the number of mismatches
+static int replay(const uint8_t *data, int length)
+{
+    capture_record_t *records = calloc(length / 4 + 1, sizeof(capture_record_t));
+    int count = decode_capture(data, length, records);
+    if (count < 0)
+    {
+        printf("capture has a record before the first sync\n");
+        free(records);
+        return 1;
+    }
+
+    replaying = true;
+    replay_statuses = replay_commands = 0;
+    replay_sent_read = replay_sent_write = 0;
+    int mismatches = 0;
+    unsigned long start = tick_count;
+    for (int i = 0; i < count; i++)
+    {
+        capture_record_t *record = &records[i];
+
+        // Run up to the tick that the record was made during, starting
+        // with the tick that the first record was made during
+        while (tick_count - start <= record->tick - records[0].tick)
+        {
+            // Handle the bytes from the PC that were received after the last status
+            poll_usb();
+            mismatches += replay_unmatched_commands();
+
+            tick_count++;
+            TIMER1_COMPA_vect();
+            update_relay();
+        }
+
+        switch (record->direction)
+        {
+            case SNIFFER_FROM_PC:
+                usb_send_byte(record->value);
+                break;
+            case SNIFFER_FROM_DOME:
+                dome_replies[dome_replies_write].value = record->value;
+                dome_replies[dome_replies_write].ready_tick = tick_count + 1;
+                dome_replies_write = (dome_replies_write + 1) % DOME_REPLY_SIZE;
+                break;
+            case SNIFFER_TO_PC:
+            {
+                // The status is sent after the bytes received with it have been handled
+                unsigned long sent = statuses_sent;
+                poll_usb();
+                replay_statuses++;
+                if (statuses_sent == sent)
+                {
+                    printf("tick %lu: no status was sent, the capture has %u\n", tick_count, record->value);
+                    mismatches++;
+                }
+                else if (status_sent != record->value)
+                {
+                    printf("tick %lu: status %u was sent, the capture has %u\n", tick_count, status_sent, record->value);
+                    mismatches++;
+                }
+                break;
+            }
+            case SNIFFER_TO_DOME:
+                replay_commands++;
+                if (replay_sent_read == replay_sent_write)
+                {
+                    printf("tick %lu: nothing was sent to the dome, the capture has 0x%02X\n", tick_count, record->value);
+                    mismatches++;
+                }
+                else
+                {
+                    uint8_t sent = replay_sent[replay_sent_read];
+                    replay_sent_read = (replay_sent_read + 1) % DOME_REPLY_SIZE;
+                    if (sent != record->value)
+                    {
+                        printf("tick %lu: sent 0x%02X to the dome, the capture has 0x%02X\n", tick_count, sent, record->value);
+                        mismatches++;
+                    }
+                }
+                break;
+        }
+    }
+
+    poll_usb();
+    mismatches += replay_unmatched_commands();
+    replaying = false;
+    free(records);
+
+    printf("%-28s %d records over %lu ticks\n", "replayed", count, tick_count - start);
+    printf("%-28s %d statuses, %d dome bytes\n", "compared", replay_statuses, replay_commands);
+    printf("%-28s %d\n", "mismatches", mismatches);
+    return mismatches;
+}
+
+// The timer4 overflow interrupt from indicator.c
+void TIMER4_OVF_vect(void);
+
+static bool is_indicator_blinking(void)
+{
+    return TCCR4A & _BV(COM4A1);
+}
+
+// The LED must only keep blinking while the timer1 tick is running
+static void scenario_indicator(void)
+{
+    if (!is_indicator_blinking() || !(TIMSK4 & _BV(TOIE4)))
+        fail("indicator was not started");
+
+    // The 1Hz patterns end a blink period every other tick
+    for (int i = 0; i < 10; i++)
+    {
+        tick();
+        if (i % 2)
+            TIMER4_OVF_vect();
+    }
+
+    // The 4Hz warning pattern ends two periods every tick
+    arm_heartbeat(12);
+    run_ticks(2);
+    for (int i = 0; i < 4; i++)
+    {
+        tick();
+        TIMER4_OVF_vect();
+        TIMER4_OVF_vect();
+    }
+
+    if (!is_indicator_blinking())
+        fail("indicator stopped while the tick was running");
+
+    // Stop the tick: the LED stops within 1.5 seconds (six 0.25 second periods)
+    int periods = 0;
+    while (is_indicator_blinking())
+    {
+        if (++periods > 6)
+            fail("indicator kept blinking without the tick");
+
+        TIMER4_OVF_vect();
+    }
+
+    printf("%-28s %d periods\n", "stopped blinking after", periods);
+    if (PORTC & _BV(PC7))
+        fail("indicator was not left off");
+
+    tick();
+    if (!is_indicator_blinking())
+        fail("indicator did not restart with the tick");
+}
+
+// A status that the host never received must not be recorded, and a capture of a
+// close must replay against the same firmware without any mismatches
+static void scenario_replay(void)
+{
+    // The replay starts from the EEPROM that the capture started with
+    uint8_t a_learned = shutter_a_learned_steps_eeprom;
+    uint8_t b_learned = shutter_b_learned_steps_eeprom;
+    saved_state_t state = saved_state_eeprom;
+
+    capturing = true;
+    const uint8_t start[] = { CMD_SNIFFER, 1 };
+    usb_send(start, sizeof(start));
+    poll_usb();
+    run_ticks(2);
+    arm_heartbeat(6);
+    run_ticks(2);
+
+    usb_port_open = false;
+    tick();
+    unsigned long dropped = tick_count;
+    usb_port_open = true;
+
+    run_until(is_relay_enabled, 10, "heartbeat did not trip");
+    run_until(is_relay_disabled, 20, "dome was not released");
+    run_ticks(2);
+
+    const uint8_t stop[] = { CMD_SNIFFER, 0 };
+    usb_send(stop, sizeof(stop));
+    tick();
+    capturing = false;
+    printf("%-28s %d bytes\n", "captured", capture_length);
+
+    // The sniffer counts the same ticks as tick_count
+    capture_record_t *records = calloc(capture_length / 4 + 1, sizeof(capture_record_t));
+    int count = decode_capture(capture, capture_length, records);
+    for (int i = 0; i < count; i++)
+        if (records[i].direction == SNIFFER_TO_PC && records[i].tick == dropped)
+            fail("status that was dropped was recorded");
+    free(records);
+
+    power_cycle();
+    shutter_a_learned_steps_eeprom = a_learned;
+    shutter_b_learned_steps_eeprom = b_learned;
+    saved_state_eeprom = state;
+    power_cycle();
+
+    if (replay(capture, capture_length) != 0)
+        fail("replay did not match the capture");
+
+    if (replay_commands != 10)
+        fail("close commands were not replayed");
+
+    if (!triggered || relay_enabled)
+        fail("replay did not leave the dome closed");
+}
+
+#if FAST_CLOSE_INPUT
+// Check that an edge started the debounce timer for the clock after the current one
+static void check_debounce_started(uint16_t timer)
+{
+    uint16_t expected = (timer + FAST_CLOSE_DEBOUNCE_CLOCKS) % (OCR1A + 1);
+    printf("%-28s %4u -> %4u\n", "debounce compare", timer, OCR1B);
+    if (!(TIMSK1 & _BV(OCIE1B)))
+        fail("debounce timer was not started");
+    if (OCR1B != expected)
+        fail("debounce timer was not set 8 clocks ahead");
+}
+
+static void check_tripped(void)
+{
+    if (!relay_enabled || !triggered || !active)
+        fail("fast-close input did not trip");
+
+    // The next tick is brought forward to send the first command straight away
+    if (TCNT1 != OCR1A - 2)
+        fail("first close command was not brought forward");
+
+    tick();
+    if (dome_log_length != 1 || dome_log[0] != 'R')
+        fail("close did not start on the next tick");
+}
+
+// Asserting the input while the heartbeat is armed must close the dome once it has been debounced
+static void scenario_fast_close(void)
+{
+    arm_heartbeat(240);
+    run_ticks(2);
+
+    TCNT1 = 1000;
+    set_fast_close(true);
+    check_debounce_started(1000);
+
+    // The compare may fall in the next timer1 period
+    TCNT1 = 7810;
+    set_fast_close(false);
+    set_fast_close(true);
+    check_debounce_started(7810);
+
+    TIMER1_COMPB_vect();
+    update_relay();
+    if (TIMSK1 & _BV(OCIE1B))
+        fail("debounce timer was not stopped");
+
+    check_tripped();
+}
+
+// Pulses shorter than the debounce must be ignored, and
+// a bouncing input must only trip once it has settled
+static void scenario_fast_close_bounce(void)
+{
+    arm_heartbeat(240);
+    run_ticks(2);
+
+    TCNT1 = 2000;
+    set_fast_close(true);
+    set_fast_close(false);
+    TIMER1_COMPB_vect();
+    update_relay();
+    if (relay_enabled)
+        fail("tripped on a pulse");
+
+    // Every asserting edge restarts the timer, so it only expires once the input has settled
+    for (int i = 0; i < 10; i++)
+    {
+        TCNT1 = 3000 + i;
+        set_fast_close(true);
+        check_debounce_started(3000 + i);
+        set_fast_close(false);
+        if (relay_enabled)
+            fail("tripped while the input was bouncing");
+    }
+
+    TIMER1_COMPB_vect();
+    update_relay();
+    if (relay_enabled)
+        fail("tripped after the input was released");
+
+    TCNT1 = 4000;
+    set_fast_close(true);
+    TIMER1_COMPB_vect();
+    update_relay();
+    check_tripped();
+}
+
+// An input that is already asserted when the heartbeat is armed has no edge to
+// trigger on, so must be found when the lease is taken or on the timer1 tick
+static void scenario_fast_close_held(void)
+{
+    set_fast_close(true);
+    run_ticks(4);
+    if (relay_enabled || (TIMSK1 & _BV(OCIE1B)))
+        fail("tripped while the heartbeat was disabled");
+
+    TCNT1 = 500;
+    arm_heartbeat(240);
+    check_debounce_started(500);
+
+    // The tick restarts the timer too
+    TIMSK1 &= ~_BV(OCIE1B);
+    TCNT1 = 0;
+    tick();
+    check_debounce_started(0);
+
+    TIMER1_COMPB_vect();
+    update_relay();
+    check_tripped();
+
+    run_until(is_relay_disabled, 20, "dome was not released");
+    if (last_status() != 255)
+        fail("status was not left at 255");
+}
+#endif
+
+// The benchmark assumes that a fully open shutter needs this many steps to close,
+// leaving some of MAX_SHUTTER_CLOSE_STEPS spare for a slow or noisy close
+#define BENCH_TRAVEL_STEPS (MAX_SHUTTER_CLOSE_STEPS * 4 / 5)
+#define BENCH_MAX_LATENCY 2
+#define BENCH_DROP_PERCENT 2
+
+static int compare_ticks(const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *)a;
+    unsigned long y = *(const unsigned long *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Print the median, 99th percentile and maximum of a set of tick counts in seconds
+static void print_percentiles(unsigned long *ticks, int count)
+{
+    qsort(ticks, count, sizeof(unsigned long), compare_ticks);
+    printf(" %6.1f %6.1f %6.1f", ticks[count / 2] * 0.5, ticks[count * 99 / 100] * 0.5, ticks[count - 1] * 0.5);
+}
+
+// Trip the heartbeat count times against a dome that starts each close from a random
+// position, replies up to BENCH_MAX_LATENCY ticks late and loses BENCH_DROP_PERCENT of
+// the bytes in each direction, then print the time until the dome was closed and the time
+// that the relay was enabled for. The learned close steps carry over between closes,
+// as they would on a real dome.
+static int bench(int count, unsigned int seed)
+{
+    unsigned long *closed = calloc(count, sizeof(unsigned long));
+    unsigned long *released = calloc(count, sizeof(unsigned long));
+    int left_open = 0;
+
+    srand(seed);
+    dome_latency = BENCH_MAX_LATENCY;
+    dome_drop_percent = BENCH_DROP_PERCENT;
+
+    for (int i = 0; i < count; i++)
+    {
+        reopen_dome(rand() % (BENCH_TRAVEL_STEPS + 1), rand() % (BENCH_TRAVEL_STEPS + 1));
+
+        // Lease 0 expires on the next tick
+        arm_heartbeat(1);
+        run_until(is_relay_enabled, 2, "heartbeat did not trip");
+        unsigned long tripped = relay_changed_tick;
+        run_until(is_relay_disabled, 4 * MAX_SHUTTER_CLOSE_STEPS + 10, "dome was not released");
+
+        released[i] = relay_changed_tick - tripped;
+        if (dome_a_steps != 0 || dome_b_steps != 0)
+        {
+            left_open++;
+            closed[i] = released[i];
+        }
+        else
+            closed[i] = dome_closed_tick - tripped;
+    }
+
+    printf("%5d %5s %7s %11s %5d", MAX_SHUTTER_CLOSE_STEPS, HAS_BUMPER_GUARD ? "yes" : "no",
+        CLOSE_B_FIRST ? "B" : "A", CLOSE_INTERLEAVED ? "interleaved" : "sequential", count);
+    print_percentiles(closed, count);
+    print_percentiles(released, count);
+    printf(" %9d\n", left_open);
+
+    free(closed);
+    free(released);
+    return left_open == 0 ? 0 : 1;
+}
+
+typedef struct
+{
+    const char *name;
+    void (*run)(void);
+} scenario_t;
+
+static const scenario_t scenarios[] =
+{
+    { "close", scenario_close },
+    { "slow-shutter", scenario_slow_shutter },
+    { "pending-command", scenario_pending_command },
+    { "restore-mirror", scenario_restore_mirror },
+    { "restore-eeprom", scenario_restore_eeprom },
+    { "replay", scenario_replay },
+    { "indicator", scenario_indicator },
+#if FAST_CLOSE_INPUT
+    { "fast-close", scenario_fast_close },
+    { "fast-close-bounce", scenario_fast_close_bounce },
+    { "fast-close-held", scenario_fast_close_held },
+#endif
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "bench") == 0)
+    {
+        power_cycle();
+        return bench(atoi(argv[2]), 1);
+    }
+
+    if (argc == 3 && strcmp(argv[1], "replay") == 0)
+    {
+        FILE *file = fopen(argv[2], "rb");
+        if (!file)
+        {
+            fprintf(stderr, "unable to open %s\n", argv[2]);
+            return 2;
+        }
+
+        capture_length = fread(capture, 1, CAPTURE_SIZE, file);
+        fclose(file);
+
+        power_cycle();
+        return replay(capture, capture_length) == 0 ? 0 : 1;
+    }
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <scenario>, %s bench <trips>, or %s replay <capture>\n", argv[0], argv[0], argv[0]);
+        return 2;
+    }
+
+    const scenario_t *scenario = NULL;
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        if (strcmp(argv[1], scenarios[i].name) == 0)
+            scenario = &scenarios[i];
+
+    if (!scenario)
+    {
+        fprintf(stderr, "unknown scenario %s\n", argv[1]);
+        return 2;
+    }
+
+    power_cycle();
+
+    printf("%s:\n", scenario->name);
+    scenario->run();
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,463 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+// Builds network.c for the host and passes it frames as the RNDIS interface in usb.c
+// would. Each frame that it sends back is checked field by field, with the checksums
+// recalculated here rather than by network.c
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../network.c"
+
+// The host's end of the link (see usb.c)
+static const uint8_t host_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x4D, 0x02 };
+static const uint8_t host_ip[4] = { 169, 254, 12, 34 };
+#define HOST_PORT 40000
+
+// Frame waiting to be read by network_receive
+static uint8_t received[256];
+static uint16_t received_length = 0;
+
+// Frames sent by network.c
+static uint8_t sent[256];
+static uint16_t sent_length = 0;
+static int frames_sent = 0;
+
+static void fail(const char *message)
+{
+    printf("FAIL: %s\n", message);
+    exit(1);
+}
+
+uint16_t usb_network_read(uint8_t *data, uint16_t length)
+{
+    // The RNDIS driver drops frames that don't fit in the buffer
+    uint16_t size = received_length <= length ? received_length : 0;
+    memcpy(data, received, size);
+    received_length = 0;
+    return size;
+}
+
+void usb_network_write(uint8_t *data, uint16_t length)
+{
+    if (length > sizeof(sent))
+        fail("sent frame is too long");
+
+    memcpy(sent, data, length);
+    sent_length = length;
+    frames_sent++;
+}
+
+static uint16_t get_word(const uint8_t *data, int offset)
+{
+    return (data[offset] << 8) | data[offset + 1];
+}
+
+static void put_word(uint8_t *data, int offset, uint16_t value)
+{
+    data[offset] = value >> 8;
+    data[offset + 1] = value;
+}
+
+// Ones' complement sum of a block, which is 0xFFFF for a block with a valid checksum
+static uint16_t ones_sum(const uint8_t *data, int length)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < length; i++)
+        sum += i & 1 ? data[i] : data[i] << 8;
+
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return sum;
+}
+
+// Fill in an IPv4 header from the host to the monitor, with a valid checksum
+static void build_ip(uint8_t *data, uint8_t protocol, uint16_t total_length)
+{
+    memcpy(data + ETH_DEST, local_mac, 6);
+    memcpy(data + ETH_SOURCE, host_mac, 6);
+    put_word(data, ETH_TYPE, ETH_TYPE_IPV4);
+
+    data[IP_VERSION] = IP_VERSION_4;
+    data[IP_VERSION + 1] = 0;
+    put_word(data, IP_TOTAL_LENGTH, total_length);
+    put_word(data, IP_ID, 0x1234);
+    put_word(data, IP_FRAGMENT, IP_DONT_FRAGMENT);
+    data[IP_TTL] = 64;
+    data[IP_PROTOCOL] = protocol;
+    put_word(data, IP_CHECKSUM, 0);
+    memcpy(data + IP_SOURCE, host_ip, 4);
+    memcpy(data + IP_DEST, local_ip, 4);
+    put_word(data, IP_CHECKSUM, ~ones_sum(data + ETH_HEADER, IP_HEADER - ETH_HEADER));
+}
+
+// Build a datagram to NETWORK_UDP_PORT with the given payload and UDP length field,
+// in a frame of the given length
+static void build_udp(const uint8_t *payload, int payload_length, uint16_t udp_length, uint16_t frame_length)
+{
+    memset(received, 0, sizeof(received));
+    build_ip(received, IP_PROTOCOL_UDP, frame_length - ETH_HEADER);
+    put_word(received, UDP_SOURCE_PORT, HOST_PORT);
+    put_word(received, UDP_DEST_PORT, NETWORK_UDP_PORT);
+    put_word(received, UDP_LENGTH, udp_length);
+    put_word(received, UDP_CHECKSUM, 0);
+    memcpy(received + UDP_DATA, payload, payload_length);
+    received_length = frame_length;
+}
+
+// Build a ping with data_length bytes of data
+static void build_ping(int data_length)
+{
+    memset(received, 0, sizeof(received));
+    build_ip(received, IP_PROTOCOL_ICMP, IP_HEADER - ETH_HEADER + ICMP_HEADER + data_length);
+    received[ICMP_TYPE] = ICMP_ECHO_REQUEST;
+    received[ICMP_TYPE + 1] = 0;
+    put_word(received, ICMP_CHECKSUM, 0);
+    put_word(received, ICMP_TYPE + 4, 0xBEEF);
+    put_word(received, ICMP_TYPE + 6, 1);
+    for (int i = 0; i < data_length; i++)
+        received[IP_HEADER + ICMP_HEADER + i] = 0x80 + i;
+
+    put_word(received, ICMP_CHECKSUM, ~ones_sum(received + IP_HEADER, ICMP_HEADER + data_length));
+    received_length = IP_HEADER + ICMP_HEADER + data_length;
+}
+
+static void build_arp(const uint8_t *target_ip)
+{
+    memset(received, 0, sizeof(received));
+    memset(received + ETH_DEST, 0xFF, 6);
+    memcpy(received + ETH_SOURCE, host_mac, 6);
+    put_word(received, ETH_TYPE, ETH_TYPE_ARP);
+    put_word(received, ARP_HARDWARE, ARP_ETHERNET);
+    put_word(received, ARP_PROTOCOL, ETH_TYPE_IPV4);
+    received[ARP_HARDWARE + 4] = 6;
+    received[ARP_HARDWARE + 5] = 4;
+    put_word(received, ARP_OPERATION, ARP_REQUEST);
+    memcpy(received + ARP_SENDER_MAC, host_mac, 6);
+    memcpy(received + ARP_SENDER_IP, host_ip, 4);
+    memcpy(received + ARP_TARGET_IP, target_ip, 4);
+    received_length = ETHERNET_MIN_FRAME;
+}
+
+// Pass the waiting frame to network_receive, and return its result
+static int16_t receive(uint8_t *data, uint8_t length)
+{
+    frames_sent = 0;
+    sent_length = 0;
+    return network_receive(data, length);
+}
+
+// The frame length that must be sent for a packet of the given length:
+// at least the minimum Ethernet frame, and never ending on a full USB packet
+static uint16_t padded_length(uint16_t length)
+{
+    if (length < ETHERNET_MIN_FRAME)
+        length = ETHERNET_MIN_FRAME;
+
+    return (RNDIS_HEADER_SIZE + length) % RNDIS_PACKET_SIZE == 0 ? length + 1 : length;
+}
+
+// Check the Ethernet and IPv4 headers of a sent packet
+static void check_ip_header(const uint8_t *mac, const uint8_t *ip, uint8_t protocol, uint8_t ttl, uint16_t total_length)
+{
+    if (memcmp(sent + ETH_DEST, mac, 6) != 0 || memcmp(sent + ETH_SOURCE, local_mac, 6) != 0 ||
+        get_word(sent, ETH_TYPE) != ETH_TYPE_IPV4)
+        fail("wrong Ethernet header");
+
+    if (sent[IP_VERSION] != IP_VERSION_4 || get_word(sent, IP_TOTAL_LENGTH) != total_length ||
+        (get_word(sent, IP_FRAGMENT) & IP_FRAGMENT_MASK) != 0 || sent[IP_TTL] != ttl || sent[IP_PROTOCOL] != protocol ||
+        memcmp(sent + IP_SOURCE, local_ip, 4) != 0 || memcmp(sent + IP_DEST, ip, 4) != 0)
+        fail("wrong IPv4 header");
+
+    if (ones_sum(sent + ETH_HEADER, IP_HEADER - ETH_HEADER) != 0xFFFF)
+        fail("wrong IPv4 header checksum");
+
+    if (sent_length != padded_length(ETH_HEADER + total_length))
+        fail("wrong padding");
+}
+
+// ARP requests for the monitor's address are answered with its MAC address,
+// and requests for other addresses are ignored
+static void scenario_arp(void)
+{
+    build_arp(local_ip);
+    if (receive(NULL, 0) != -1 || frames_sent != 1)
+        fail("ARP request was not answered");
+
+    printf("%-28s %u bytes, sender %02X:%02X:%02X:%02X:%02X:%02X\n", "ARP reply", sent_length,
+        sent[ARP_SENDER_MAC], sent[ARP_SENDER_MAC + 1], sent[ARP_SENDER_MAC + 2],
+        sent[ARP_SENDER_MAC + 3], sent[ARP_SENDER_MAC + 4], sent[ARP_SENDER_MAC + 5]);
+
+    if (memcmp(sent + ETH_DEST, host_mac, 6) != 0 || memcmp(sent + ETH_SOURCE, local_mac, 6) != 0 ||
+        get_word(sent, ETH_TYPE) != ETH_TYPE_ARP)
+        fail("wrong Ethernet header");
+
+    if (get_word(sent, ARP_HARDWARE) != ARP_ETHERNET || get_word(sent, ARP_PROTOCOL) != ETH_TYPE_IPV4 ||
+        sent[ARP_HARDWARE + 4] != 6 || sent[ARP_HARDWARE + 5] != 4 || get_word(sent, ARP_OPERATION) != ARP_REPLY)
+        fail("wrong ARP header");
+
+    if (memcmp(sent + ARP_SENDER_MAC, local_mac, 6) != 0 || memcmp(sent + ARP_SENDER_IP, local_ip, 4) != 0 ||
+        memcmp(sent + ARP_TARGET_MAC, host_mac, 6) != 0 || memcmp(sent + ARP_TARGET_IP, host_ip, 4) != 0)
+        fail("wrong ARP addresses");
+
+    if (sent_length != ETHERNET_MIN_FRAME)
+        fail("wrong padding");
+
+    const uint8_t other_ip[4] = { 169, 254, 77, 2 };
+    build_arp(other_ip);
+    if (receive(NULL, 0) != -1 || frames_sent != 0)
+        fail("ARP request for another address was answered");
+
+    // A reply from the host must not be answered
+    build_arp(local_ip);
+    put_word(received, ARP_OPERATION, ARP_REPLY);
+    if (receive(NULL, 0) != -1 || frames_sent != 0)
+        fail("ARP reply was answered");
+
+    // Nor a request that is cut short
+    build_arp(local_ip);
+    received_length = ARP_END - 1;
+    if (receive(NULL, 0) != -1 || frames_sent != 0)
+        fail("short ARP request was answered");
+
+    printf("%-28s ignored\n", "other ARP frames");
+}
+
+// Pings are answered with the same identifier, sequence and data, and a valid checksum
+static void scenario_ping(void)
+{
+    // Both an odd and an even amount of data, so that the checksum of the last byte is covered
+    const int data_lengths[] = { 0, 33, 56, 86 };
+    for (size_t i = 0; i < sizeof(data_lengths) / sizeof(data_lengths[0]); i++)
+    {
+        int length = data_lengths[i];
+        uint8_t request[256];
+
+        build_ping(length);
+        memcpy(request, received, received_length);
+
+        // Frames can carry padding after the packet, which must not be summed with an odd last byte
+        if (received_length < NETWORK_FRAME_SIZE)
+            received[received_length++] = 0xFF;
+
+        if (receive(NULL, 0) != -1 || frames_sent != 1)
+            fail("ping was not answered");
+
+        uint16_t icmp_sum = ones_sum(sent + IP_HEADER, ICMP_HEADER + length);
+        printf("ping with %2d bytes of data   %u bytes, ICMP checksum 0x%04X, sum 0x%04X\n",
+            length, sent_length, get_word(sent, ICMP_CHECKSUM), icmp_sum);
+
+        check_ip_header(host_mac, host_ip, IP_PROTOCOL_ICMP, REPLY_TTL, IP_HEADER - ETH_HEADER + ICMP_HEADER + length);
+        if (sent[ICMP_TYPE] != ICMP_ECHO_REPLY || sent[ICMP_TYPE + 1] != 0)
+            fail("wrong ICMP type");
+
+        if (icmp_sum != 0xFFFF)
+            fail("wrong ICMP checksum");
+
+        if (memcmp(sent + ICMP_TYPE + 4, request + ICMP_TYPE + 4, ICMP_HEADER - 4 + length) != 0)
+            fail("echoed data does not match the request");
+    }
+
+    // Pings with a broken IP header must not be answered, nor echo replies
+    build_ping(16);
+    received[IP_CHECKSUM] ^= 0x01;
+    if (receive(NULL, 0) != -1 || frames_sent != 0)
+        fail("ping with a bad IP checksum was answered");
+
+    build_ping(16);
+    received[ICMP_TYPE] = ICMP_ECHO_REPLY;
+    if (receive(NULL, 0) != -1 || frames_sent != 0)
+        fail("echo reply was answered");
+
+    printf("%-28s ignored\n", "broken pings");
+}
+
+// Datagrams are only accepted when their IP and UDP lengths fit inside the frame,
+// and the reply is sent back to the port that the datagram came from
+static void scenario_udp(void)
+{
+    const uint8_t payload[] = { 0xA5, 0x01, 0x02, 0x03, 0x04 };
+    uint8_t data[8];
+    int16_t length;
+
+    // Frames may be padded beyond the end of the packet, so the IP length
+    // and then the UDP length decide how much of the frame is the datagram
+    build_udp(payload, sizeof(payload), UDP_DATA - IP_HEADER + sizeof(payload), ETHERNET_MIN_FRAME);
+    put_word(received, IP_TOTAL_LENGTH, UDP_DATA - ETH_HEADER + sizeof(payload));
+    put_word(received, IP_CHECKSUM, 0);
+    put_word(received, IP_CHECKSUM, ~ones_sum(received + ETH_HEADER, IP_HEADER - ETH_HEADER));
+    length = receive(data, sizeof(data));
+    printf("%-28s %d bytes\n", "padded datagram", length);
+    if (length != sizeof(payload) || memcmp(data, payload, sizeof(payload)) != 0)
+        fail("padded datagram was not received");
+
+    // A UDP length shorter than the IP data only covers part of it
+    build_udp(payload, sizeof(payload), UDP_DATA - IP_HEADER + 2, UDP_DATA + sizeof(payload));
+    length = receive(data, sizeof(data));
+    printf("%-28s %d bytes\n", "short UDP length", length);
+    if (length != 2 || memcmp(data, payload, 2) != 0)
+        fail("datagram was not cut to its UDP length");
+
+    // The datagram is cut to the caller's buffer
+    build_udp(payload, sizeof(payload), UDP_DATA - IP_HEADER + sizeof(payload), UDP_DATA + sizeof(payload));
+    length = receive(data, 3);
+    printf("%-28s %d bytes\n", "3 byte buffer", length);
+    if (length != 3 || memcmp(data, payload, 3) != 0)
+        fail("datagram was not cut to the buffer");
+
+    // Lengths that run past the end of the frame or the IP data, or are shorter than the headers
+    const struct
+    {
+        const char *name;
+        uint16_t udp_length;
+        uint16_t ip_length;
+    } broken[] =
+    {
+        { "UDP length past IP data", UDP_DATA - IP_HEADER + sizeof(payload) + 1, UDP_DATA - ETH_HEADER + sizeof(payload) },
+        { "UDP length below header", UDP_DATA - IP_HEADER - 1, UDP_DATA - ETH_HEADER + sizeof(payload) },
+        { "IP length past frame", UDP_DATA - IP_HEADER + sizeof(payload), UDP_DATA - ETH_HEADER + sizeof(payload) + 1 },
+        { "IP length below header", UDP_DATA - IP_HEADER + sizeof(payload), IP_HEADER - ETH_HEADER - 1 },
+        { "IP data below UDP header", UDP_DATA - IP_HEADER, UDP_DATA - ETH_HEADER - 1 },
+    };
+
+    for (size_t i = 0; i < sizeof(broken) / sizeof(broken[0]); i++)
+    {
+        build_udp(payload, sizeof(payload), broken[i].udp_length, UDP_DATA + sizeof(payload));
+        put_word(received, IP_TOTAL_LENGTH, broken[i].ip_length);
+        put_word(received, IP_CHECKSUM, 0);
+        put_word(received, IP_CHECKSUM, ~ones_sum(received + ETH_HEADER, IP_HEADER - ETH_HEADER));
+        length = receive(data, sizeof(data));
+        printf("%-28s %s\n", broken[i].name, length == -1 ? "dropped" : "received");
+        if (length != -1 || frames_sent != 0)
+            fail("datagram with a bad length was received");
+    }
+
+    // Fragments and datagrams to other ports are dropped
+    build_udp(payload, sizeof(payload), UDP_DATA - IP_HEADER + sizeof(payload), UDP_DATA + sizeof(payload));
+    put_word(received, IP_FRAGMENT, 0x2000);
+    put_word(received, IP_CHECKSUM, 0);
+    put_word(received, IP_CHECKSUM, ~ones_sum(received + ETH_HEADER, IP_HEADER - ETH_HEADER));
+    if (receive(data, sizeof(data)) != -1)
+        fail("fragment was received");
+
+    build_udp(payload, sizeof(payload), UDP_DATA - IP_HEADER + sizeof(payload), UDP_DATA + sizeof(payload));
+    put_word(received, UDP_DEST_PORT, NETWORK_UDP_PORT + 1);
+    if (receive(data, sizeof(data)) != -1)
+        fail("datagram to another port was received");
+
+    // The reply goes back to the sender of the last datagram that was received
+    build_udp(payload, sizeof(payload), UDP_DATA - IP_HEADER + sizeof(payload), UDP_DATA + sizeof(payload));
+    if (receive(data, sizeof(data)) != sizeof(payload))
+        fail("datagram was not received");
+
+    const uint8_t status[] = { 0x42, 0x07 };
+    network_reply(status, sizeof(status));
+    printf("%-28s %u bytes, to port %u, UDP length %u\n", "reply", sent_length,
+        get_word(sent, UDP_DEST_PORT), get_word(sent, UDP_LENGTH));
+
+    check_ip_header(host_mac, host_ip, IP_PROTOCOL_UDP, REPLY_TTL, UDP_DATA - ETH_HEADER + sizeof(status));
+    if (get_word(sent, UDP_SOURCE_PORT) != NETWORK_UDP_PORT || get_word(sent, UDP_DEST_PORT) != HOST_PORT ||
+        get_word(sent, UDP_LENGTH) != UDP_DATA - IP_HEADER + sizeof(status) || get_word(sent, UDP_CHECKSUM) != 0 ||
+        memcmp(sent + UDP_DATA, status, sizeof(status)) != 0)
+        fail("wrong reply");
+
+    // Announcements go to the multicast group, and don't leave the USB link
+    const uint8_t group_address[4] = { 239, 255, 77, 1 };
+    const uint8_t group_address_mac[6] = { 0x01, 0x00, 0x5E, 0x7F, 0x4D, 0x01 };
+    network_announce(status, 1);
+    check_ip_header(group_address_mac, group_address, IP_PROTOCOL_UDP, ANNOUNCE_TTL, UDP_DATA - ETH_HEADER + 1);
+    if (get_word(sent, UDP_DEST_PORT) != NETWORK_UDP_PORT)
+        fail("wrong announcement");
+
+    printf("%-28s %u bytes, TTL %u\n", "announcement", sent_length, sent[IP_TTL]);
+}
+
+// Frames that would fill the last USB packet of the RNDIS transfer are padded
+// by a byte, and every other frame is sent at its own length
+static void scenario_padding(void)
+{
+    int padded = 0;
+    for (int length = 0; length <= UDP_DATA_MAX + 1; length++)
+    {
+        uint8_t data[UDP_DATA_MAX + 1] = { 0 };
+        network_announce(data, length);
+
+        uint16_t sent_data = length <= UDP_DATA_MAX ? length : UDP_DATA_MAX;
+        uint16_t frame_length = UDP_DATA + sent_data;
+        check_ip_header(group_mac, group_ip, IP_PROTOCOL_UDP, ANNOUNCE_TTL, frame_length - ETH_HEADER);
+        if ((RNDIS_HEADER_SIZE + sent_length) % RNDIS_PACKET_SIZE == 0)
+            fail("frame fills the last USB packet");
+
+        if (sent_length != frame_length && frame_length >= ETHERNET_MIN_FRAME)
+        {
+            printf("%-28s %u byte frame sent as %u bytes\n", "datagram", frame_length, sent_length);
+            if (sent[sent_length - 1] != 0)
+                fail("padding byte is not zero");
+            padded++;
+        }
+    }
+
+    for (int length = 0; length <= NETWORK_FRAME_SIZE - IP_HEADER - ICMP_HEADER; length++)
+    {
+        build_ping(length);
+        receive(NULL, 0);
+        uint16_t frame_length = IP_HEADER + ICMP_HEADER + length;
+        check_ip_header(host_mac, host_ip, IP_PROTOCOL_ICMP, REPLY_TTL, frame_length - ETH_HEADER);
+        if ((RNDIS_HEADER_SIZE + sent_length) % RNDIS_PACKET_SIZE == 0)
+            fail("frame fills the last USB packet");
+
+        if (sent_length != frame_length && frame_length >= ETHERNET_MIN_FRAME)
+        {
+            printf("%-28s %u byte frame sent as %u bytes\n", "ping reply", frame_length, sent_length);
+            padded++;
+        }
+    }
+
+    if (padded != 2)
+        fail("wrong number of padded frames");
+}
+
+typedef struct
+{
+    const char *name;
+    void (*run)(void);
+} scenario_t;
+
+static const scenario_t scenarios[] =
+{
+    { "arp", scenario_arp },
+    { "ping", scenario_ping },
+    { "udp", scenario_udp },
+    { "padding", scenario_padding },
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <scenario>\n", argv[0]);
+        return 2;
+    }
+
+    const scenario_t *scenario = NULL;
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        if (strcmp(argv[1], scenarios[i].name) == 0)
+            scenario = &scenarios[i];
+
+    if (!scenario)
+    {
+        fprintf(stderr, "unknown scenario %s\n", argv[1]);
+        return 2;
+    }
+
+    printf("%s:\n", scenario->name);
+    scenario->run();
+    printf("PASS\n");
+    return 0;
+}
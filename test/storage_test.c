@@ -0,0 +1,373 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+// Builds storage.c for the host and sends it SCSI commands as LUFA's mass storage
+// class driver would. The IN endpoint is modelled as a single 64 byte bank that the
+// simulated host reads a packet at a time, and can stop reading or reset part way
+// through a command (see host/LUFA/Drivers/USB/USB.h)
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../storage.c"
+
+#define ENDPOINT_SIZE 64
+#define IN_ADDRESS    0x85
+#define CDC_ADDRESS   0x83
+
+// Learned close steps reported in CONFIG.TXT (see main.c)
+uint8_t EEMEM shutter_a_learned_steps_eeprom = 41;
+uint8_t EEMEM shutter_b_learned_steps_eeprom = 0;
+
+static USB_ClassInfo_MS_Device_t interface = { .Config = { .DataINEndpoint = { .Address = IN_ADDRESS } } };
+
+static uint8_t selected_endpoint = IN_ADDRESS;
+static uint8_t bank[ENDPOINT_SIZE];
+static int bank_length = 0;
+
+// Bytes in the packets that the host has read
+#define HOST_DATA_SIZE (STORAGE_TOTAL_SECTORS * STORAGE_SECTOR_SIZE)
+static uint8_t host_data[HOST_DATA_SIZE];
+static int host_data_length = 0;
+
+// The host stops reading (or resets the interface) after this many packets, or never if -1
+static int host_read_limit = -1;
+static int host_reset_after = -1;
+static int packets_read = 0;
+static bool packet_unread = false;
+static int waits_aborted = 0;
+
+// Number of times that the main loop was run during a command
+static int polls = 0;
+
+static void fail(const char *message)
+{
+    printf("FAIL: %s\n", message);
+    exit(1);
+}
+
+void Endpoint_SelectEndpoint(uint8_t address)
+{
+    selected_endpoint = address;
+}
+
+bool Endpoint_IsReadWriteAllowed(void)
+{
+    return bank_length < ENDPOINT_SIZE;
+}
+
+void Endpoint_ClearIN(void)
+{
+    if (host_read_limit >= 0 && packets_read >= host_read_limit)
+        packet_unread = true;
+    else
+    {
+        memcpy(host_data + host_data_length, bank, bank_length);
+        host_data_length += bank_length;
+        packets_read++;
+
+        if (packets_read == host_reset_after)
+        {
+            interface.State.IsMassStoreReset = true;
+            host_read_limit = packets_read;
+        }
+    }
+
+    bank_length = 0;
+}
+
+void Endpoint_Write_8(uint8_t data)
+{
+    if (selected_endpoint != IN_ADDRESS)
+        fail("wrote to the wrong endpoint");
+    if (bank_length == ENDPOINT_SIZE)
+        fail("wrote to a full bank");
+
+    bank[bank_length++] = data;
+}
+
+// The wait only succeeds once the host has read the last packet, and the
+// abort check is only made while waiting, as in LUFA's Endpoint_AVR8.c
+uint8_t Endpoint_WaitUntilReady_Bounded(uint16_t timeout_ms, bool (*abort_check)(void))
+{
+    if (!packet_unread)
+        return ENDPOINT_READYWAIT_NoError;
+
+    if (abort_check && abort_check())
+    {
+        waits_aborted++;
+        return ENDPOINT_READYWAIT_Aborted;
+    }
+
+    return ENDPOINT_READYWAIT_Timeout;
+}
+
+// The stream functions are only used for the short responses, which are sent as one packet
+uint8_t Endpoint_Write_Stream_LE(const void *buffer, uint16_t length, uint16_t *bytes_processed)
+{
+    for (uint16_t i = 0; i < length; i++)
+        Endpoint_Write_8(((const uint8_t *)buffer)[i]);
+
+    return ENDPOINT_READYWAIT_NoError;
+}
+
+uint8_t Endpoint_Write_PStream_LE(const void *buffer, uint16_t length, uint16_t *bytes_processed)
+{
+    return Endpoint_Write_Stream_LE(buffer, length, bytes_processed);
+}
+
+uint8_t Endpoint_Null_Stream(uint16_t length, uint16_t *bytes_processed)
+{
+    for (uint16_t i = 0; i < length; i++)
+        Endpoint_Write_8(0);
+
+    return ENDPOINT_READYWAIT_NoError;
+}
+
+// The main loop selects the CDC endpoints while it handles the heartbeat pings
+void poll_usb(void)
+{
+    selected_endpoint = CDC_ADDRESS;
+    polls++;
+}
+
+// Send a command with the data length that the host expects, and return whether it passed
+static bool command(const uint8_t *cdb, int cdb_length, uint32_t length)
+{
+    memset(&interface.State, 0, sizeof(interface.State));
+    memcpy(interface.State.CommandBlock.SCSICommandData, cdb, cdb_length);
+    interface.State.CommandBlock.SCSICommandLength = cdb_length;
+    interface.State.CommandBlock.DataTransferLength = length;
+
+    selected_endpoint = IN_ADDRESS;
+    bank_length = 0;
+    host_data_length = 0;
+    packets_read = 0;
+    packet_unread = false;
+    waits_aborted = 0;
+    polls = 0;
+
+    return CALLBACK_MS_Device_SCSICommandReceived(&interface);
+}
+
+static bool read_10(uint32_t first, uint16_t count)
+{
+    const uint8_t cdb[] =
+    {
+        SCSI_CMD_READ_10, 0, first >> 24, first >> 16, first >> 8, first, 0, count >> 8, count, 0
+    };
+
+    return command(cdb, sizeof(cdb), (uint32_t)count * STORAGE_SECTOR_SIZE);
+}
+
+static void check_sense(uint8_t key, uint8_t code)
+{
+    printf("%-28s key 0x%02X, code 0x%02X\n", "sense", sense_data.SenseKey, sense_data.AdditionalSenseCode);
+    if (sense_data.SenseKey != key || sense_data.AdditionalSenseCode != code)
+        fail("unexpected sense data");
+}
+
+static uint16_t read_le16(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+// The 12 bit FAT entry for a cluster
+static uint16_t fat_cluster(const uint8_t *fat, uint16_t cluster)
+{
+    uint16_t pair = read_le16(fat + cluster / 2 * 3 + (cluster & 1));
+    return cluster & 1 ? pair >> 4 : pair & 0xFFF;
+}
+
+// Find a file in the root directory, returning its first cluster and size
+static void find_file(const uint8_t *image, const char *name, uint16_t *cluster, uint16_t *size)
+{
+    const uint8_t *root = image + STORAGE_ROOT_SECTOR * STORAGE_SECTOR_SIZE;
+    for (int i = 0; i < STORAGE_ROOT_ENTRIES; i++)
+    {
+        const uint8_t *entry = root + 32 * i;
+        if (memcmp(entry, name, 11) == 0)
+        {
+            *cluster = read_le16(entry + 26);
+            *size = read_le16(entry + 28);
+            printf("%-28s cluster %u, %u bytes\n", name, *cluster, *size);
+            return;
+        }
+    }
+
+    fail("file is missing from the root directory");
+}
+
+// Check that a file's line shows a value
+static void check_line(const uint8_t *file, uint16_t size, const char *name, uint32_t value)
+{
+    char line[STORAGE_NAME_WIDTH + STORAGE_VALUE_WIDTH + 3];
+    snprintf(line, sizeof(line), "%-*s%*u\r\n", STORAGE_NAME_WIDTH, name, STORAGE_VALUE_WIDTH, value);
+    if (!memmem(file, size, line, strlen(line)))
+    {
+        printf("missing line: %s", line);
+        fail("file has the wrong contents");
+    }
+}
+
+// Reading the whole disk must give a FAT12 volume with the two files,
+// and the main loop must be run between every sector
+static void scenario_read(void)
+{
+    static uint8_t image[HOST_DATA_SIZE];
+
+    stats[STATS_TRIPS] = 7;
+    stats[STATS_USB_BYTES_IN] = 4294967295u;
+
+    bool passed = read_10(0, STORAGE_TOTAL_SECTORS);
+    printf("%-28s %s, %d bytes, residue %u, %d polls\n", "read 128 sectors", passed ? "passed" : "failed",
+        host_data_length, interface.State.CommandBlock.DataTransferLength, polls);
+    if (!passed || host_data_length != HOST_DATA_SIZE || interface.State.CommandBlock.DataTransferLength != 0)
+        fail("whole disk was not read");
+    if (polls != STORAGE_TOTAL_SECTORS - 1)
+        fail("main loop was not run between the sectors");
+
+    memcpy(image, host_data, HOST_DATA_SIZE);
+
+    if (image[510] != 0x55 || image[511] != 0xAA || read_le16(image + 11) != STORAGE_SECTOR_SIZE ||
+        read_le16(image + 19) != STORAGE_TOTAL_SECTORS || memcmp(image + 54, "FAT12", 5) != 0)
+        fail("boot sector is invalid");
+
+    uint16_t stats_cluster, stats_size, config_cluster, config_size;
+    find_file(image, "STATS   TXT", &stats_cluster, &stats_size);
+    find_file(image, "CONFIG  TXT", &config_cluster, &config_size);
+
+    // Each file is a chain of clusters that ends at the end of the file
+    const uint8_t *fat = image + STORAGE_FAT_SECTOR * STORAGE_SECTOR_SIZE;
+    uint16_t clusters[] = { stats_cluster, config_cluster };
+    uint16_t sizes[] = { stats_size, config_size };
+    for (int i = 0; i < 2; i++)
+    {
+        uint16_t cluster = clusters[i];
+        for (int j = 1; j < (sizes[i] + STORAGE_SECTOR_SIZE - 1) / STORAGE_SECTOR_SIZE; j++)
+            cluster = fat_cluster(fat, cluster);
+
+        if (fat_cluster(fat, cluster) != 0xFFF)
+            fail("FAT chain does not end with the file");
+    }
+
+    const uint8_t *stats_file = image + (STORAGE_DATA_SECTOR + stats_cluster - STORAGE_FIRST_CLUSTER) * STORAGE_SECTOR_SIZE;
+    const uint8_t *config_file = image + (STORAGE_DATA_SECTOR + config_cluster - STORAGE_FIRST_CLUSTER) * STORAGE_SECTOR_SIZE;
+    check_line(stats_file, stats_size, "trips", 7);
+    check_line(stats_file, stats_size, "usb_bytes_in", 4294967295u);
+    check_line(config_file, config_size, "MAX_SHUTTER_CLOSE_STEPS", MAX_SHUTTER_CLOSE_STEPS);
+    check_line(config_file, config_size, "LEARNED_STEPS_A", 41);
+
+    // Sectors read on their own must match the whole disk read
+    for (int i = 0; i < STORAGE_TOTAL_SECTORS; i++)
+    {
+        if (!read_10(i, 1) || memcmp(host_data, image + i * STORAGE_SECTOR_SIZE, STORAGE_SECTOR_SIZE) != 0)
+            fail("sector read on its own does not match");
+    }
+}
+
+// A host that stops reading must fail the command, with only
+// the packets that it read taken off the residue
+static void scenario_read_timeout(void)
+{
+    host_read_limit = 20;
+    bool passed = read_10(0, STORAGE_TOTAL_SECTORS);
+    printf("%-28s %s, %d packets read, residue %u\n", "read stopped by the host", passed ? "passed" : "failed",
+        packets_read, interface.State.CommandBlock.DataTransferLength);
+    if (passed)
+        fail("read passed");
+    if (interface.State.CommandBlock.DataTransferLength != HOST_DATA_SIZE - 20 * ENDPOINT_SIZE)
+        fail("residue does not match the packets read");
+
+    check_sense(SCSI_SENSE_KEY_ABORTED_COMMAND, SCSI_ASENSE_NO_ADDITIONAL_INFORMATION);
+}
+
+// A mass storage reset must abandon the read at the next packet
+static void scenario_read_reset(void)
+{
+    host_reset_after = 10;
+    bool passed = read_10(0, STORAGE_TOTAL_SECTORS);
+    printf("%-28s %s, %d packets read, residue %u\n", "read reset by the host", passed ? "passed" : "failed",
+        packets_read, interface.State.CommandBlock.DataTransferLength);
+    if (passed)
+        fail("read passed");
+    if (waits_aborted != 1)
+        fail("read was not abandoned by the reset");
+    if (interface.State.CommandBlock.DataTransferLength != HOST_DATA_SIZE - 10 * ENDPOINT_SIZE)
+        fail("residue does not match the packets read");
+
+    check_sense(SCSI_SENSE_KEY_ABORTED_COMMAND, SCSI_ASENSE_NO_ADDITIONAL_INFORMATION);
+}
+
+// Out of range reads and writes must fail without sending any data
+static void scenario_errors(void)
+{
+    if (read_10(STORAGE_TOTAL_SECTORS - 8, 16) || host_data_length != 0 || bank_length != 0)
+        fail("read past the end passed");
+
+    check_sense(SCSI_SENSE_KEY_ILLEGAL_REQUEST, SCSI_ASENSE_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE);
+
+    const uint8_t write[] = { SCSI_CMD_WRITE_10, 0, 0, 0, 0, 3, 0, 0, 1, 0 };
+    if (command(write, sizeof(write), STORAGE_SECTOR_SIZE))
+        fail("write passed");
+
+    check_sense(SCSI_SENSE_KEY_DATA_PROTECT, SCSI_ASENSE_WRITE_PROTECTED);
+
+    // The sense data of the failed write is reported by REQUEST SENSE
+    const uint8_t request_sense[] = { SCSI_CMD_REQUEST_SENSE, 0, 0, 0, 18, 0 };
+    if (!command(request_sense, sizeof(request_sense), 18) || host_data_length != 18 ||
+        (host_data[2] & 0x0F) != SCSI_SENSE_KEY_DATA_PROTECT || host_data[12] != SCSI_ASENSE_WRITE_PROTECTED)
+        fail("REQUEST SENSE did not report the failed write");
+
+    const uint8_t inquiry[] = { SCSI_CMD_INQUIRY, 0, 0, 0, 36, 0 };
+    if (!command(inquiry, sizeof(inquiry), 36) || host_data_length != 36 || memcmp(host_data + 16, "Dome Heartbeat", 14) != 0)
+        fail("INQUIRY did not report the device");
+
+    printf("%-28s %.8s %.16s\n", "inquiry", host_data + 8, host_data + 16);
+}
+
+typedef struct
+{
+    const char *name;
+    void (*run)(void);
+} scenario_t;
+
+static const scenario_t scenarios[] =
+{
+    { "read", scenario_read },
+    { "read-timeout", scenario_read_timeout },
+    { "read-reset", scenario_read_reset },
+    { "errors", scenario_errors },
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <scenario>\n", argv[0]);
+        return 2;
+    }
+
+    const scenario_t *scenario = NULL;
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        if (strcmp(argv[1], scenarios[i].name) == 0)
+            scenario = &scenarios[i];
+
+    if (!scenario)
+    {
+        fprintf(stderr, "unknown scenario %s\n", argv[1]);
+        return 2;
+    }
+
+    storage_initialize();
+
+    printf("%s:\n", scenario->name);
+    scenario->run();
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,403 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+// Builds twi.c for the host against a model of the ATmega32u4 TWI peripheral in
+// master mode, with a single register-based slave device on the bus.
+// Each command that twi.c writes to TWCR is carried out on the simulated bus, and
+// the next status is raised through TWI_vect. The bus conditions are logged as
+//   S, Sr, P   start, repeated start and stop
+//   90+, 05-   address or data byte sent by the master, and whether it was ACKed
+//   r2A+       byte read from the slave, and whether the master ACKed it
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../twi.c"
+
+#define SLAVE_ADDRESS 0x48
+
+static uint8_t slave_registers[256];
+static uint8_t slave_pointer;
+static int slave_bytes_written;
+
+// The slave NACKs the data byte after this many, or never if -1
+static int slave_nack_after = -1;
+
+// The slave holds the clock low after its address, until the next stop
+static bool slave_stall = false;
+static bool stalled = false;
+
+static bool bus_busy = false;
+static bool sending_address;
+static bool master_reading;
+
+static char bus_log[512];
+
+// Transactions in the order that their callbacks were run
+static twi_transaction_t *finished[8];
+static int finished_count = 0;
+
+static void fail(const char *message)
+{
+    printf("FAIL: %s\n", message);
+    exit(1);
+}
+
+static void log_event(const char *event)
+{
+    if (bus_log[0])
+        strcat(bus_log, " ");
+    strcat(bus_log, event);
+}
+
+static void log_byte(const char *prefix, uint8_t value, bool ack)
+{
+    char event[8];
+    snprintf(event, sizeof(event), "%s%02X%c", prefix, value, ack ? '+' : '-');
+    log_event(event);
+}
+
+// Report a bus status to twi.c as the hardware would, by setting TWINT and raising the interrupt
+static void raise(uint8_t control, uint8_t status)
+{
+    TWSR = status | (TWSR & (_BV(TWPS0) | _BV(TWPS1)));
+    if (control & _BV(TWIE))
+        TWI_vect();
+}
+
+// Carry out the commands written to TWCR until the bus is idle or the slave stalls
+// Writing TWINT clears the interrupt flag and starts the next bus operation
+static void bus_run(void)
+{
+    for (int steps = 0; TWCR & _BV(TWINT); steps++)
+    {
+        if (steps > 100)
+            fail("bus never became idle");
+
+        uint8_t control = TWCR;
+
+        // The hardware clears TWSTO once the stop has been sent
+        TWCR &= ~(_BV(TWINT) | _BV(TWSTO));
+        if (!(control & _BV(TWEN)))
+            continue;
+
+        if (control & _BV(TWSTO))
+        {
+            log_event("P");
+            bus_busy = false;
+            stalled = false;
+            if (!(control & _BV(TWSTA)))
+                continue;
+        }
+
+        if (control & _BV(TWSTA))
+        {
+            log_event(bus_busy ? "Sr" : "S");
+            uint8_t status = bus_busy ? TW_REP_START : TW_START;
+            bus_busy = true;
+            sending_address = true;
+            raise(control, status);
+            continue;
+        }
+
+        if (!bus_busy)
+            fail("byte sent without a start");
+
+        if (stalled)
+            fail("byte sent while the slave holds the clock");
+
+        if (sending_address)
+        {
+            uint8_t address = TWDR;
+            bool ack = (address >> 1) == SLAVE_ADDRESS;
+            log_byte("", address, ack);
+            sending_address = false;
+            master_reading = address & TW_READ;
+            slave_bytes_written = 0;
+
+            if (ack && slave_stall)
+            {
+                stalled = true;
+                continue;
+            }
+
+            if (master_reading)
+                raise(control, ack ? TW_MR_SLA_ACK : TW_MR_SLA_NACK);
+            else
+                raise(control, ack ? TW_MT_SLA_ACK : TW_MT_SLA_NACK);
+        }
+        else if (!master_reading)
+        {
+            // The first byte written selects the register, and the rest are stored from it
+            bool ack = slave_nack_after < 0 || slave_bytes_written < slave_nack_after;
+            log_byte("", TWDR, ack);
+            if (ack)
+            {
+                if (slave_bytes_written++ == 0)
+                    slave_pointer = TWDR;
+                else
+                    slave_registers[slave_pointer++] = TWDR;
+            }
+
+            raise(control, ack ? TW_MT_DATA_ACK : TW_MT_DATA_NACK);
+        }
+        else
+        {
+            bool ack = control & _BV(TWEA);
+            TWDR = slave_registers[slave_pointer++];
+            log_byte("r", TWDR, ack);
+            raise(control, ack ? TW_MR_DATA_ACK : TW_MR_DATA_NACK);
+        }
+    }
+}
+
+static void transaction_finished(twi_transaction_t *transaction)
+{
+    if (finished_count < 8)
+        finished[finished_count++] = transaction;
+}
+
+static void submit(twi_transaction_t *transaction)
+{
+    if (!twi_submit(transaction))
+        fail("transaction was not queued");
+
+    bus_run();
+}
+
+static void check_log(const char *expected)
+{
+    printf("%-28s %s\n", "bus", bus_log);
+    if (strcmp(bus_log, expected) != 0)
+    {
+        printf("%-28s %s\n", "expected", expected);
+        fail("wrong bus conditions");
+    }
+
+    bus_log[0] = 0;
+}
+
+static void check_status(const char *name, twi_transaction_t *transaction, uint8_t status)
+{
+    const char *names[] = { "complete", "NACK", "error", "pending" };
+    printf("%-28s %s\n", name, names[transaction->status]);
+    if (transaction->status != status)
+        fail("wrong transaction status");
+}
+
+// A register read is sent as a write of the register address, then a repeated start
+// to read the data, and a transaction queued behind it starts after its stop
+static void scenario_write_read(void)
+{
+    slave_registers[0x05] = 0x2A;
+    slave_registers[0x06] = 0x3B;
+
+    uint8_t read_register = 0x05;
+    uint8_t read_data[2] = { 0 };
+    twi_transaction_t read =
+    {
+        .address = SLAVE_ADDRESS,
+        .write_data = &read_register,
+        .write_length = 1,
+        .read_data = read_data,
+        .read_length = 2,
+        .callback = transaction_finished,
+    };
+
+    uint8_t write_data[3] = { 0x10, 0x77, 0x78 };
+    twi_transaction_t write =
+    {
+        .address = SLAVE_ADDRESS,
+        .write_data = write_data,
+        .write_length = 3,
+        .callback = transaction_finished,
+    };
+
+    // The first transaction is started, but waits for the interrupts
+    if (!twi_submit(&read) || !twi_submit(&write))
+        fail("transactions were not queued");
+
+    if (twi_submit(&read))
+        fail("pending transaction was queued twice");
+
+    bus_run();
+    check_log("S 90+ 05+ Sr 91+ r2A+ r3B- P S 90+ 10+ 77+ 78+ P");
+
+    check_status("register read", &read, TWI_COMPLETE);
+    printf("%-28s 0x%02X 0x%02X\n", "read data", read_data[0], read_data[1]);
+    if (read_data[0] != 0x2A || read_data[1] != 0x3B)
+        fail("wrong data read");
+
+    check_status("register write", &write, TWI_COMPLETE);
+    if (slave_registers[0x10] != 0x77 || slave_registers[0x11] != 0x78)
+        fail("wrong data written");
+
+    if (finished_count != 2 || finished[0] != &read || finished[1] != &write)
+        fail("callbacks were not run in order");
+
+    // A read without a register address carries on from the register after the
+    // last one written, and NACKs its only byte
+    slave_registers[0x12] = 0x79;
+    read.write_length = 0;
+    read.read_length = 1;
+    submit(&read);
+    check_log("S 91+ r79- P");
+    check_status("read without a register", &read, TWI_COMPLETE);
+    if (read_data[0] != 0x79)
+        fail("wrong data read");
+}
+
+// A missing device NACKs its address, and a device may NACK data part way through a write
+static void scenario_nack(void)
+{
+    uint8_t data[3] = { 0x20, 0x01, 0x02 };
+    twi_transaction_t write =
+    {
+        .address = SLAVE_ADDRESS + 1,
+        .write_data = data,
+        .write_length = 3,
+        .callback = transaction_finished,
+    };
+
+    submit(&write);
+    check_log("S 92- P");
+    check_status("write to missing device", &write, TWI_NACK);
+
+    uint8_t read_data[1];
+    twi_transaction_t read =
+    {
+        .address = SLAVE_ADDRESS + 1,
+        .read_data = read_data,
+        .read_length = 1,
+        .callback = transaction_finished,
+    };
+
+    submit(&read);
+    check_log("S 93- P");
+    check_status("read from missing device", &read, TWI_NACK);
+
+    // The bus is stopped after the NACKed byte, without sending the rest
+    slave_nack_after = 2;
+    write.address = SLAVE_ADDRESS;
+    submit(&write);
+    check_log("S 90+ 20+ 01+ 02- P");
+    check_status("write NACKed by device", &write, TWI_NACK);
+    if (slave_registers[0x20] != 0x01 || slave_registers[0x21] != 0x00)
+        fail("wrong data written");
+
+    // The register read is abandoned if its register address is NACKed
+    slave_nack_after = 0;
+    read.address = SLAVE_ADDRESS;
+    read.write_data = data;
+    read.write_length = 1;
+    submit(&read);
+    check_log("S 90+ 20- P");
+    check_status("register NACKed by device", &read, TWI_NACK);
+
+    if (finished_count != 4)
+        fail("callbacks were not run");
+}
+
+// A device that holds the clock low stalls the transaction until twi_tick resets the bus
+// after TWI_TIMEOUT_TICKS, and the next queued transaction is then started
+static void scenario_timeout(void)
+{
+    // Nothing to do while the bus is idle
+    twi_tick();
+    bus_run();
+    check_log("");
+
+    slave_registers[0x30] = 0x55;
+    uint8_t read_register = 0x30;
+    uint8_t read_data[1] = { 0 };
+    twi_transaction_t stalled_read =
+    {
+        .address = SLAVE_ADDRESS,
+        .write_data = &read_register,
+        .write_length = 1,
+        .read_data = read_data,
+        .read_length = 1,
+        .callback = transaction_finished,
+    };
+
+    twi_transaction_t read = stalled_read;
+
+    slave_stall = true;
+    submit(&stalled_read);
+    twi_submit(&read);
+    bus_run();
+    check_log("S 90+");
+
+    int ticks = 0;
+    while (stalled_read.status == TWI_PENDING && ticks < 10)
+    {
+        twi_tick();
+        ticks++;
+        slave_stall = false;
+        bus_run();
+    }
+
+    printf("%-28s %d\n", "ticks until the bus reset", ticks);
+    if (ticks != TWI_TIMEOUT_TICKS + 1)
+        fail("stalled transaction was not abandoned on time");
+
+    check_log("P S 90+ 30+ Sr 91+ r55- P");
+    check_status("stalled read", &stalled_read, TWI_ERROR);
+    check_status("queued read", &read, TWI_COMPLETE);
+    if (read_data[0] != 0x55)
+        fail("wrong data read");
+
+    if (finished_count != 2 || finished[0] != &stalled_read || finished[1] != &read)
+        fail("callbacks were not run in order");
+
+    // The bus is left idle with the peripheral enabled
+    if (bus_busy || !(TWCR & _BV(TWEN)))
+        fail("bus was not left idle");
+}
+
+typedef struct
+{
+    const char *name;
+    void (*run)(void);
+} scenario_t;
+
+static const scenario_t scenarios[] =
+{
+    { "write-read", scenario_write_read },
+    { "nack", scenario_nack },
+    { "timeout", scenario_timeout },
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <scenario>\n", argv[0]);
+        return 2;
+    }
+
+    const scenario_t *scenario = NULL;
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        if (strcmp(argv[1], scenarios[i].name) == 0)
+            scenario = &scenarios[i];
+
+    if (!scenario)
+    {
+        fprintf(stderr, "unknown scenario %s\n", argv[1]);
+        return 2;
+    }
+
+    twi_initialize();
+    if (TWBR != 72 || !(TWCR & _BV(TWEN)))
+        fail("bus was not set up for 100kHz");
+
+    printf("%s:\n", scenario->name);
+    scenario->run();
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,88 @@
+#
+# Copyright 2017 Paul Chote
+# This file is part of dome-heartbeat-monitor, which is free software. It is made
+# available to you under version 3 (or later) of the GNU General Public License,
+# as published by the Free Software Foundation and included in the LICENSE file.
+#
+
+"""Shared helpers for talking to the heartbeat monitor's USB serial port"""
+
+import os
+import select
+import termios
+import tty
+
+# Status bytes in the 2Hz status stream: the heartbeat countdown (0-240),
+# 254 while closing, or 255 once triggered. Every other byte starts a reply.
+STATUS_CLOSING = 254
+STATUS_TRIGGERED = 255
+
+def is_status(value):
+    """Returns true if a byte from the monitor is a status byte rather than the start of a reply"""
+    return value <= 240 or value >= STATUS_CLOSING
+
+def status_name(value):
+    """Describes a status byte"""
+    if value == 0:
+        return 'disabled'
+    if value == STATUS_CLOSING:
+        return 'closing'
+    if value == STATUS_TRIGGERED:
+        return 'triggered'
+    return '{:.1f}s remaining'.format(value / 2)
+
+class Port:
+    """USB serial port of a heartbeat monitor, opened in raw mode"""
+    def __init__(self, path):
+        self._fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        try:
+            tty.setraw(self._fd, termios.TCSANOW)
+        except termios.error:
+            os.close(self._fd)
+            raise OSError('{} is not a serial port'.format(path))
+
+        self._buffer = b''
+
+    def close(self):
+        os.close(self._fd)
+
+    def write(self, data):
+        os.write(self._fd, bytes(data))
+
+    def read(self, timeout):
+        """Returns the bytes that are available, waiting up to timeout seconds for the first"""
+        if self._buffer:
+            data, self._buffer = self._buffer, b''
+            return data
+
+        ready, _, _ = select.select([self._fd], [], [], timeout)
+        return os.read(self._fd, 4096) if ready else b''
+
+    def read_exact(self, length, timeout=2):
+        """Reads length bytes, raising an error if they aren't received within timeout seconds"""
+        data = b''
+        while len(data) < length:
+            chunk = self.read(timeout)
+            if not chunk:
+                raise TimeoutError('expected {} bytes, received {}'.format(length, len(data)))
+            data += chunk
+
+        self._buffer = data[length:]
+        return data[:length]
+
+    def command(self, command, reply_length, timeout=2):
+        """Sends a command and returns the first reply_length bytes after its reply prefix
+           Any remaining bytes of the reply can then be read with read_exact"""
+        termios.tcflush(self._fd, termios.TCIFLUSH)
+        self._buffer = b''
+        self.write([command])
+
+        # Skip the status bytes that are sent before the reply
+        while True:
+            prefix = self.read_exact(1, timeout)[0]
+            if prefix == command:
+                break
+            if not is_status(prefix):
+                raise ValueError('unexpected reply {} to command {}'.format(prefix, command))
+
+        return self.read_exact(reply_length, timeout)
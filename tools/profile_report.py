@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+#
+# Copyright 2017 Paul Chote
+# This file is part of dome-heartbeat-monitor, which is free software. It is made
+# available to you under version 3 (or later) of the GNU General Public License,
+# as published by the Free Software Foundation and included in the LICENSE file.
+#
+
+"""Reads the profiler histogram (command 249) from a PROFILE = 1 build
+and prints a flat profile of the functions in main.elf
+
+The histogram is cleared by each read, so running this again after a
+while profiles the time since the previous run"""
+
+import argparse
+import subprocess
+import sys
+from heartbeat import Port
+
+CMD_REPORT_PROFILE = 0xF9
+
+def read_histogram(path):
+    """Returns the bucket shift and the sample count of each bucket"""
+    port = Port(path)
+    try:
+        shift, count = port.command(CMD_REPORT_PROFILE, 2)
+        data = port.read_exact(2 * count)
+    finally:
+        port.close()
+
+    return shift, [int.from_bytes(data[2 * i:2 * i + 2], 'little') for i in range(count)]
+
+def read_functions(elf, nm):
+    """Returns a list of (start, end, name) for each function in the firmware's flash"""
+    output = subprocess.run([nm, '-n', '-S', '-C', '--defined-only', elf],
+                            check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+
+    functions = []
+    for line in output.splitlines():
+        fields = line.split(maxsplit=3)
+        if len(fields) != 4 or fields[2] not in 'tTwW':
+            continue
+
+        start, size = int(fields[0], 16), int(fields[1], 16)
+
+        # Data symbols are offset by 0x800000 from flash
+        if start < 0x800000 and size > 0:
+            functions.append((start, start + size, fields[3]))
+
+    return functions
+
+def flat_profile(shift, buckets, functions):
+    """Shares each bucket's samples between the functions that it overlaps,
+       in proportion to the number of bytes of each inside the bucket"""
+    # Buckets count program words, so cover twice as many flash bytes
+    bucket_bytes = 2 << shift
+    samples = {}
+    for i, count in enumerate(buckets):
+        if count == 0:
+            continue
+
+        start, end = i * bucket_bytes, (i + 1) * bucket_bytes
+        remaining = count
+        for function_start, function_end, name in functions:
+            overlap = min(end, function_end) - max(start, function_start)
+            if overlap > 0:
+                share = count * overlap / bucket_bytes
+                samples[name] = samples.get(name, 0) + share
+                remaining -= share
+
+        # Code outside any sized symbol, e.g. the interrupt vectors or startup code
+        if remaining > 0.5:
+            label = '(unknown 0x{:04X}-0x{:04X})'.format(start, end - 1)
+            samples[label] = samples.get(label, 0) + remaining
+
+    return sorted(samples.items(), key=lambda item: item[1], reverse=True)
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('path', help='USB serial port (e.g. /dev/ttyACM0)')
+    parser.add_argument('--elf', default='main.elf', help='firmware that the monitor is running (default: main.elf)')
+    parser.add_argument('--nm', default='avr-nm', help='nm command for the firmware (default: avr-nm)')
+    parser.add_argument('--buckets', action='store_true', help='also print the samples in each bucket')
+    args = parser.parse_args()
+
+    functions = read_functions(args.elf, args.nm)
+    shift, buckets = read_histogram(args.path)
+    total = sum(buckets)
+    if total == 0:
+        print('no samples: is the firmware built with PROFILE = 1?')
+        return 1
+
+    if args.buckets:
+        bucket_bytes = 2 << shift
+        for i, count in enumerate(buckets):
+            if count:
+                print('0x{:04X}-0x{:04X} {:>8}'.format(i * bucket_bytes, (i + 1) * bucket_bytes - 1, count))
+        print()
+
+    print('{:>8} {:>7}  {}'.format('samples', '%', 'function'))
+    for name, count in flat_profile(shift, buckets, functions):
+        print('{:>8.0f} {:>6.1f}%  {}'.format(count, 100 * count / total, name))
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+#
+# Copyright 2017 Paul Chote
+# This file is part of dome-heartbeat-monitor, which is free software. It is made
+# available to you under version 3 (or later) of the GNU General Public License,
+# as published by the Free Software Foundation and included in the LICENSE file.
+#
+
+"""Decodes the sniffed serial traffic (command 245) into a timeline
+
+Either streams from a monitor's USB serial port, or decodes a raw capture
+of that port's output (e.g. one saved with --save)"""
+
+import argparse
+import os
+import stat
+import sys
+from heartbeat import Port, status_name
+
+CMD_SNIFFER = 0xF5
+SNIFFER_RECORD = 0xF6
+SNIFFER_SYNC = 0xFC
+
+# Each record is 4 bytes, and the timestamps count in 256us units
+RECORD_SIZE = 4
+TIMESTAMP_SECONDS = 256e-6
+
+DIRECTIONS = ['from dome', 'to dome', 'from PC', 'to PC']
+DIRECTION_TO_PC = 3
+
+class Decoder:
+    def __init__(self, output):
+        self._output = output
+        self._pending = b''
+        self._epoch = None
+        self._start = None
+        self._previous = None
+
+    def feed(self, data):
+        data = self._pending + data
+        i = 0
+        while i < len(data):
+            # Status bytes that weren't recorded (and any command replies) are skipped
+            if data[i] not in (SNIFFER_RECORD, SNIFFER_SYNC):
+                i += 1
+                continue
+
+            if len(data) - i < RECORD_SIZE:
+                break
+
+            self._record(data[i], data[i + 1], data[i + 2] | (data[i + 3] << 8))
+            i += RECORD_SIZE
+
+        self._pending = data[i:]
+
+    def _record(self, prefix, value, word):
+        if prefix == SNIFFER_SYNC:
+            self._epoch = word
+            return
+
+        if self._epoch is None:
+            print('warning: record received before the first sync; times may be wrong', file=sys.stderr)
+            self._epoch = 0
+
+        direction = word >> 14
+        time = ((self._epoch << 14) | (word & 0x3FFF)) * TIMESTAMP_SECONDS
+        if self._start is None:
+            self._start = self._previous = time
+
+        if direction == DIRECTION_TO_PC:
+            description = 'status {} ({})'.format(value, status_name(value))
+        else:
+            description = '0x{:02X}'.format(value)
+            if 32 <= value < 127:
+                description += " '{}'".format(chr(value))
+
+        print('{:12.4f} {:+10.4f}  {:<9}  {}'.format(
+            time - self._start, time - self._previous, DIRECTIONS[direction], description), file=self._output)
+        self._output.flush()
+        self._previous = time
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('path', help='USB serial port (e.g. /dev/ttyACM0) or capture file')
+    parser.add_argument('--save', metavar='FILE', help='also save the raw stream from the port to FILE')
+    args = parser.parse_args()
+
+    print('{:>12} {:>10}  {:<9}  {}'.format('time (s)', 'delta (s)', 'dir', 'byte'))
+    decoder = Decoder(sys.stdout)
+
+    if not stat.S_ISCHR(os.stat(args.path).st_mode):
+        with open(args.path, 'rb') as capture:
+            decoder.feed(capture.read())
+        return
+
+    port = Port(args.path)
+    save = open(args.save, 'wb') if args.save else None
+    try:
+        port.write([CMD_SNIFFER, 1])
+        while True:
+            data = port.read(1)
+            if save:
+                save.write(data)
+            decoder.feed(data)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        port.write([CMD_SNIFFER, 0])
+        port.close()
+        if save:
+            save.close()
+
+if __name__ == '__main__':
+    main()
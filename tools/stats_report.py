@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+#
+# Copyright 2017 Paul Chote
+# This file is part of dome-heartbeat-monitor, which is free software. It is made
+# available to you under version 3 (or later) of the GNU General Public License,
+# as published by the Free Software Foundation and included in the LICENSE file.
+#
+
+"""Reads and prints the event counters (command 248) from one or more monitors"""
+
+import argparse
+import json
+import sys
+import time
+from heartbeat import Port
+
+CMD_REPORT_STATS = 0xF8
+
+# Counter names in the order of their STATS_ indices (see stats.h)
+COUNTER_NAMES = [
+    'usb_bytes_in',
+    'usb_bytes_out',
+    'usb_send_failed',
+    'usb_dtr_dropped',
+    'trip_resets',
+    'serial_bytes_in',
+    'serial_bytes_out',
+    'serial_overruns',
+    'bridge_dropped',
+    'sniffer_dropped',
+    'trips',
+    'closes',
+]
+
+# Counters saturate at this value instead of wrapping
+SATURATED = 0xFFFFFFFF
+
+def parse_snapshot(count, data):
+    """Returns a dictionary of counter values from a 248 reply"""
+    counters = {}
+    for i in range(count):
+        name = COUNTER_NAMES[i] if i < len(COUNTER_NAMES) else 'counter_{}'.format(i)
+        counters[name] = int.from_bytes(data[4 * i:4 * i + 4], 'little')
+    return counters
+
+def read_counters(path):
+    port = Port(path)
+    try:
+        count = port.command(CMD_REPORT_STATS, 1)[0]
+        return parse_snapshot(count, port.read_exact(4 * count))
+    finally:
+        port.close()
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('paths', nargs='+', metavar='path', help='USB serial port (e.g. /dev/ttyACM0)')
+    parser.add_argument('--json', action='store_true',
+                        help='print one JSON object per monitor, for collecting the counters periodically')
+    args = parser.parse_args()
+
+    failed = False
+    for path in args.paths:
+        try:
+            counters = read_counters(path)
+        except (OSError, TimeoutError, ValueError) as error:
+            print('{}: {}'.format(path, error), file=sys.stderr)
+            failed = True
+            continue
+
+        if args.json:
+            print(json.dumps({'port': path, 'time': time.time(), 'counters': counters}))
+            continue
+
+        print(path)
+        for name, value in counters.items():
+            print('  {:<20} {:>10}{}'.format(name, value, ' (saturated)' if value == SATURATED else ''))
+
+    return 1 if failed else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
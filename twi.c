@@ -0,0 +1,182 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#if TWI_BUS
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <util/atomic.h>
+#include <util/twi.h>
+#include "twi.h"
+
+// The bus runs at 100kHz
+#define TWI_FREQUENCY 100000UL
+
+// Number of timer1 ticks (0.5 seconds) that a transaction may take
+// before the bus is reset (e.g. a device holding the clock low)
+#define TWI_TIMEOUT_TICKS 2
+
+#define TWI_START    TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE)
+#define TWI_CONTINUE TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE)
+#define TWI_ACK      TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE)
+#define TWI_STOP     TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN)
+
+// Transactions are queued as a linked list, with the head being transferred
+static twi_transaction_t *queue_head = NULL;
+static twi_transaction_t *queue_tail = NULL;
+static uint8_t transfer_index;
+static bool reading;
+static uint8_t active_ticks;
+
+void twi_initialize(void)
+{
+    // Enable the internal pull-ups on SCL and SDA
+    // Longer cables will need stronger external pull-ups
+    PORTD |= _BV(PD0) | _BV(PD1);
+
+    TWSR = 0;
+    TWBR = (F_CPU / TWI_FREQUENCY - 16) / 2;
+    TWCR = _BV(TWEN);
+}
+
+// Begin the transaction at the head of the queue
+// Must only be called with interrupts disabled
+static void start_transaction(void)
+{
+    transfer_index = 0;
+    reading = queue_head->write_length == 0 && queue_head->read_length > 0;
+    active_ticks = 0;
+
+    // If a stop is still being sent then the start will follow it
+    TWCR = (TWCR & _BV(TWSTO)) | _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+}
+
+// Report the result of the head transaction and start the next one
+// Must only be called with interrupts disabled
+static void finish_transaction(uint8_t status)
+{
+    twi_transaction_t *transaction = queue_head;
+    queue_head = transaction->next;
+    if (queue_head == NULL)
+        queue_tail = NULL;
+
+    TWI_STOP;
+
+    transaction->status = status;
+    if (transaction->callback)
+        transaction->callback(transaction);
+
+    if (queue_head != NULL)
+        start_transaction();
+}
+
+// Add a transaction to the queue
+// Returns false if the transaction is already pending
+bool twi_submit(twi_transaction_t *transaction)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (transaction->status == TWI_PENDING)
+            return false;
+
+        transaction->status = TWI_PENDING;
+        transaction->next = NULL;
+
+        if (queue_tail != NULL)
+            queue_tail->next = transaction;
+        else
+        {
+            queue_head = transaction;
+            start_transaction();
+        }
+
+        queue_tail = transaction;
+    }
+
+    return true;
+}
+
+// Called from the timer1 ISR every 0.5 seconds
+// Abandons a transaction that has stalled and resets the bus
+void twi_tick(void)
+{
+    if (queue_head == NULL || ++active_ticks <= TWI_TIMEOUT_TICKS)
+        return;
+
+    TWCR = 0;
+    TWCR = _BV(TWEN);
+    finish_transaction(TWI_ERROR);
+}
+
+ISR(TWI_vect)
+{
+    twi_transaction_t *transaction = queue_head;
+    if (transaction == NULL)
+    {
+        TWI_STOP;
+        return;
+    }
+
+    switch (TW_STATUS)
+    {
+        case TW_START:
+        case TW_REP_START:
+            TWDR = (transaction->address << 1) | (reading ? TW_READ : TW_WRITE);
+            TWI_CONTINUE;
+            break;
+
+        case TW_MT_SLA_ACK:
+        case TW_MT_DATA_ACK:
+            if (transfer_index < transaction->write_length)
+            {
+                TWDR = transaction->write_data[transfer_index++];
+                TWI_CONTINUE;
+            }
+            else if (transaction->read_length > 0)
+            {
+                // Repeated start to switch to reading
+                transfer_index = 0;
+                reading = true;
+                TWI_START;
+            }
+            else
+                finish_transaction(TWI_COMPLETE);
+            break;
+
+        case TW_MR_DATA_ACK:
+            transaction->read_data[transfer_index++] = TWDR;
+            // Fall through
+        case TW_MR_SLA_ACK:
+            // NACK the last byte to tell the device that the read is complete
+            if (transfer_index + 1 < transaction->read_length)
+                TWI_ACK;
+            else
+                TWI_CONTINUE;
+            break;
+
+        case TW_MR_DATA_NACK:
+            transaction->read_data[transfer_index++] = TWDR;
+            finish_transaction(TWI_COMPLETE);
+            break;
+
+        case TW_MT_SLA_NACK:
+        case TW_MT_DATA_NACK:
+        case TW_MR_SLA_NACK:
+            finish_transaction(TWI_NACK);
+            break;
+
+        default:
+            // Lost arbitration or bus error
+            finish_transaction(TWI_ERROR);
+            break;
+    }
+}
+
+#endif
@@ -0,0 +1,44 @@
+//**********************************************************************************
+//  Copyright 2017 Paul Chote
+//  This file is part of dome-heartbeat-monitor, which is free software. It is made
+//  available to you under version 3 (or later) of the GNU General Public License,
+//  as published by the Free Software Foundation and included in the LICENSE file.
+//**********************************************************************************
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef DOME_HEARTBEAT_TWI_H
+#define DOME_HEARTBEAT_TWI_H
+
+// Transaction status
+#define TWI_COMPLETE 0
+#define TWI_NACK     1
+#define TWI_ERROR    2
+#define TWI_PENDING  3
+
+typedef struct twi_transaction twi_transaction_t;
+
+// Called from the TWI ISR once the transaction has finished
+typedef void (*twi_callback_t)(twi_transaction_t *transaction);
+
+// Writes write_length bytes to the 7 bit address, then reads read_length
+// bytes after a repeated start. Either length may be zero.
+// The transaction and its buffers must not be touched while it is pending.
+struct twi_transaction
+{
+    uint8_t address;
+    uint8_t *write_data;
+    uint8_t write_length;
+    uint8_t *read_data;
+    uint8_t read_length;
+    twi_callback_t callback;
+    volatile uint8_t status;
+    twi_transaction_t *next;
+};
+
+void twi_initialize(void);
+bool twi_submit(twi_transaction_t *transaction);
+void twi_tick(void);
+
+#endif
@@ -7,11 +7,13 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <LUFA/Drivers/USB/USB.h>
 #include <LUFA/Common/Common.h>
 #include "usb_descriptors.h"
+#include "stats.h"
 
 USB_ClassInfo_CDC_Device_t interface =
 {
@@ -22,13 +24,13 @@ USB_ClassInfo_CDC_Device_t interface =
         {
             .Address            = CDC_TX_EPADDR,
             .Size               = CDC_TXRX_EPSIZE,
-            .Banks              = 1,
+            .Banks              = CDC_TXRX_BANKS,
         },
         .DataOUTEndpoint        =
         {
             .Address            = CDC_RX_EPADDR,
             .Size               = CDC_TXRX_EPSIZE,
-            .Banks              = 1,
+            .Banks              = CDC_TXRX_BANKS,
         },
         .NotificationEndpoint   =
         {
@@ -39,10 +41,106 @@ USB_ClassInfo_CDC_Device_t interface =
     },
 };
 
+#if BRIDGE_MODE
+USB_ClassInfo_CDC_Device_t bridge_interface =
+{
+    .Config =
+    {
+        .ControlInterfaceNumber = INTERFACE_ID_BRIDGE_CCI,
+        .DataINEndpoint         =
+        {
+            .Address            = BRIDGE_TX_EPADDR,
+            .Size               = CDC_TXRX_EPSIZE,
+            .Banks              = CDC_TXRX_BANKS,
+        },
+        .DataOUTEndpoint        =
+        {
+            .Address            = BRIDGE_RX_EPADDR,
+            .Size               = CDC_TXRX_EPSIZE,
+            .Banks              = CDC_TXRX_BANKS,
+        },
+        .NotificationEndpoint   =
+        {
+            .Address            = BRIDGE_NOTIFICATION_EPADDR,
+            .Size               = CDC_NOTIFICATION_EPSIZE,
+            .Banks              = 1,
+        },
+    },
+};
+#endif
+
+#if MASS_STORAGE
+USB_ClassInfo_MS_Device_t storage_interface =
+{
+    .Config =
+    {
+        .InterfaceNumber        = INTERFACE_ID_MASS_STORAGE,
+        .DataINEndpoint         =
+        {
+            .Address            = MASS_STORAGE_IN_EPADDR,
+            .Size               = MASS_STORAGE_IO_EPSIZE,
+            .Banks              = 1,
+        },
+        .DataOUTEndpoint        =
+        {
+            .Address            = MASS_STORAGE_OUT_EPADDR,
+            .Size               = MASS_STORAGE_IO_EPSIZE,
+            .Banks              = 1,
+        },
+        .TotalLUNs              = 1,
+    },
+};
+#endif
+
+#if NETWORK
+// Holds the RNDIS control messages exchanged with the host
+// LUFA needs at least 132 bytes to answer the supported OID query
+#define RNDIS_MESSAGE_BUFFER_SIZE 132
+static uint8_t rndis_message_buffer[RNDIS_MESSAGE_BUFFER_SIZE];
+
+USB_ClassInfo_RNDIS_Device_t network_interface =
+{
+    .Config =
+    {
+        .ControlInterfaceNumber = INTERFACE_ID_RNDIS_CCI,
+        .DataINEndpoint         =
+        {
+            .Address            = RNDIS_TX_EPADDR,
+            .Size               = RNDIS_TXRX_EPSIZE,
+            .Banks              = 1,
+        },
+        .DataOUTEndpoint        =
+        {
+            .Address            = RNDIS_RX_EPADDR,
+            .Size               = RNDIS_TXRX_EPSIZE,
+            .Banks              = 1,
+        },
+        .NotificationEndpoint   =
+        {
+            .Address            = RNDIS_NOTIFICATION_EPADDR,
+            .Size               = RNDIS_NOTIFICATION_EPSIZE,
+            .Banks              = 1,
+        },
+        .AdapterVendorDescription = "Dome Heartbeat Monitor",
+        .AdapterMACAddress      = {{0x02, 0x00, 0x00, 0x00, 0x4D, 0x02}},
+        .MessageBuffer          = rndis_message_buffer,
+        .MessageBufferLength    = RNDIS_MESSAGE_BUFFER_SIZE,
+    },
+};
+#endif
+
+#if TWI_BUS
+// The USB LED pins are used by the I2C bus
+#define USB_LED_UNPLUGGED
+#define USB_LED_PLUGGED
+#define USB_LED_CONNECTED
+#define USB_LED_INIT
+#else
 #define USB_LED_UNPLUGGED PORTD &= ~_BV(PD0), PORTD &= ~_BV(PD1)
 #define USB_LED_PLUGGED   PORTD |= _BV(PD0), PORTD &= ~_BV(PD1)
 #define USB_LED_CONNECTED PORTD &= ~_BV(PD0), PORTD |= _BV(PD1)
 #define USB_LED_INIT      DDRD |= _BV(PD0) | _BV(PD1)
+#endif
 
 #define TX_LED_DISABLED   PORTD &= ~_BV(5)
 #define TX_LED_ENABLED    PORTD |= _BV(5)
@@ -52,9 +150,15 @@ USB_ClassInfo_CDC_Device_t interface =
 
 // Counters (in milliseconds) for blinking the TX/RX LEDs
 #define TX_RX_LED_PULSE_MS 100
+
+// Maximum time (in milliseconds) to wait for the host to accept each packet
+#define USB_WRITE_TIMEOUT_MS 100
 volatile uint8_t tx_led_pulse;
 volatile uint8_t rx_led_pulse;
 
+// Set (from the USB interrupt) when the host opens or closes the monitor's port
+static volatile bool line_state_changed = false;
+
 void usb_initialize(void)
 {
     USB_LED_INIT;
@@ -62,64 +166,210 @@ void usb_initialize(void)
     USB_Init();
 }
 
-bool usb_can_read(void)
+// Read up to length bytes from the current receive packet
+// Returns the number of bytes read, or 0 if there was nothing to read
+uint8_t usb_read_data(uint8_t *data, uint8_t length)
 {
-    return CDC_Device_BytesReceived(&interface) > 0;
-}
-
-// Read a byte from the receive buffer
-// Will return negative if unable to read
-int16_t usb_read(void)
-{
-    int16_t ret = CDC_Device_ReceiveByte(&interface);
+    uint8_t count = CDC_Device_ReceiveData(&interface, data, length);
 
     // Flash the RX LED
-    if (ret >= 0)
+    if (count > 0)
     {
+        stats_add(STATS_USB_BYTES_IN, count);
         RX_LED_ENABLED;
         rx_led_pulse = TX_RX_LED_PULSE_MS;
         USB_Device_EnableSOFEvents();
     }
 
-    return ret;
+    return count;
 }
 
-// Add a byte to the send buffer.
-// Will block if the buffer is full
-void usb_write(uint8_t b)
+// Returns true if the host has opened or closed the port since the last call
+bool usb_line_state_changed(void)
 {
-    // Work around a bug where the device will block if the host has dropped the connection
-    // The DTR line will always (and only) be set when we have an open connection
-    if (!(interface.State.ControlLineStates.HostToDevice & CDC_CONTROL_LINE_OUT_DTR))
-        return;
+    bool changed;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        changed = line_state_changed;
+        line_state_changed = false;
+    }
 
-    // Note: This is ignoring any errors (e.g. send failed)
-    // We are only sending single byte packets, so there's no
-    // real benefits to handling them properly
-    if (CDC_Device_SendByte(&interface, b) != ENDPOINT_READYWAIT_NoError)
-        return;
+    return changed;
+}
+
+// The DTR line will always (and only) be set when we have an open connection
+static bool port_open(USB_ClassInfo_CDC_Device_t *cdc)
+{
+    return cdc->State.ControlLineStates.HostToDevice & CDC_CONTROL_LINE_OUT_DTR;
+}
+
+// Interface being written by send_data, for the endpoint wait abort check
+static USB_ClassInfo_CDC_Device_t *sending_interface;
+
+static bool sending_port_closed(void)
+{
+    return !port_open(sending_interface);
+}
+
+// Send a block of bytes and flush them to the host
+// The host closing the port (which is updated from the USB interrupt) or not reading
+// for USB_WRITE_TIMEOUT_MS abandons the write instead of blocking the main loop
+static uint8_t send_data(USB_ClassInfo_CDC_Device_t *cdc, const uint8_t *data, uint16_t length)
+{
+    if (USB_DeviceState != DEVICE_STATE_Configured || !cdc->State.LineEncoding.BaudRateBPS)
+        return ENDPOINT_READYWAIT_DeviceDisconnected;
+
+    sending_interface = cdc;
+    Endpoint_SelectEndpoint(cdc->Config.DataINEndpoint.Address);
+
+    uint16_t sent = 0;
+    uint8_t error;
+    do
+    {
+        error = Endpoint_WaitUntilReady_Bounded(USB_WRITE_TIMEOUT_MS, sending_port_closed);
+        if (error != ENDPOINT_READYWAIT_NoError)
+            return error;
 
+        // Returns IncompleteTransfer after sending each full bank
+        error = Endpoint_Write_Stream_LE(data, length, &sent);
+    } while (error == ENDPOINT_RWSTREAM_IncompleteTransfer);
+
+    if (error != ENDPOINT_RWSTREAM_NoError)
+        return error;
+
+    // Send the final packet, followed by a zero length packet if it
+    // filled the bank so that the host knows the transfer is complete
+    bool bank_full = !Endpoint_IsReadWriteAllowed();
+    Endpoint_ClearIN();
+
+    if (bank_full)
+    {
+        error = Endpoint_WaitUntilReady_Bounded(USB_WRITE_TIMEOUT_MS, sending_port_closed);
+        if (error != ENDPOINT_READYWAIT_NoError)
+            return error;
+
+        Endpoint_ClearIN();
+    }
+
+    return ENDPOINT_READYWAIT_NoError;
+}
+
+// Send a block of bytes to the host and flush them together
+// Will wait up to USB_WRITE_TIMEOUT_MS for each packet to be accepted
+// Returns false if the bytes were dropped
+bool usb_write_data(const uint8_t *data, uint16_t length)
+{
     // Work around a bug where the device will block if the host has dropped the connection
-    // The DTR line will always (and only) be set when we have an open connection
-    if (!(interface.State.ControlLineStates.HostToDevice & CDC_CONTROL_LINE_OUT_DTR))
-        return;
+    if (!port_open(&interface))
+    {
+        stats_increment(STATS_USB_DTR_DROPPED);
+        return false;
+    }
 
-    if (CDC_Device_Flush(&interface) != ENDPOINT_READYWAIT_NoError)
-        return;
+    uint8_t error = send_data(&interface, data, length);
+    if (error == ENDPOINT_READYWAIT_Aborted)
+    {
+        stats_increment(STATS_USB_DTR_DROPPED);
+        return false;
+    }
+
+    if (error != ENDPOINT_READYWAIT_NoError)
+    {
+        stats_increment(STATS_USB_SEND_FAILED);
+        return false;
+    }
+
+    stats_add(STATS_USB_BYTES_OUT, length);
 
     // Flash the TX LED
     TX_LED_ENABLED;
     tx_led_pulse = TX_RX_LED_PULSE_MS;
     USB_Device_EnableSOFEvents();
+    return true;
+}
+
+// Send a single byte to the host
+// Returns false if the byte was dropped
+bool usb_write(uint8_t b)
+{
+    return usb_write_data(&b, 1);
+}
+
+#if BRIDGE_MODE
+// Read up to length bytes from the current bridge receive packet
+// Returns the number of bytes read, or 0 if there was nothing to read
+uint8_t usb_bridge_read_data(uint8_t *data, uint8_t length)
+{
+    return CDC_Device_ReceiveData(&bridge_interface, data, length);
+}
+
+// Send a block of bytes to the bridge port and flush them together
+// Will wait up to USB_WRITE_TIMEOUT_MS for each packet to be accepted
+void usb_bridge_write_data(const uint8_t *data, uint8_t length)
+{
+    // Drop the data if nothing is listening on the bridge port
+    if (port_open(&bridge_interface))
+        send_data(&bridge_interface, data, length);
+}
+#endif
+
+#if NETWORK
+// Read the next ethernet frame from the host into frame
+// Returns the frame length, or 0 if there was nothing to read or the frame was larger than length
+uint16_t usb_network_read(uint8_t *frame, uint16_t length)
+{
+    uint16_t received;
+    if (RNDIS_Device_ReceivePacket(&network_interface, frame, length, &received) != ENDPOINT_RWSTREAM_NoError)
+        return 0;
+
+    return received;
+}
+
+// Send an ethernet frame to the host
+// Frames are dropped if the host hasn't brought the network interface up
+void usb_network_write(uint8_t *frame, uint16_t length)
+{
+    RNDIS_Device_SendPacket(&network_interface, frame, length);
 }
 
+// Send any pending RNDIS notification to the host
+void usb_network_poll(void)
+{
+    RNDIS_Device_USBTask(&network_interface);
+}
+#endif
+
+#if MASS_STORAGE
+// Handle any pending command from the host on the mass storage interface
+// Reads only return once every requested sector has been sent, but poll_usb() is called between sectors
+void usb_storage_poll(void)
+{
+    MS_Device_USBTask(&storage_interface);
+}
+#endif
+
 void EVENT_USB_Device_ConfigurationChanged(void)
 {
     CDC_Device_ConfigureEndpoints(&interface);
+#if BRIDGE_MODE
+    CDC_Device_ConfigureEndpoints(&bridge_interface);
+#endif
+#if MASS_STORAGE
+    MS_Device_ConfigureEndpoints(&storage_interface);
+#endif
+#if NETWORK
+    RNDIS_Device_ConfigureEndpoints(&network_interface);
+#endif
 }
 
 void EVENT_CDC_Device_ControLineStateChanged(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo)
 {
+    // The USB LEDs and the line state flag only follow the monitor's own port
+    if (CDCInterfaceInfo != &interface)
+        return;
+
+    line_state_changed = true;
+
     bool connected = CDCInterfaceInfo->State.ControlLineStates.HostToDevice & CDC_CONTROL_LINE_OUT_DTR;
     if (connected)
         USB_LED_CONNECTED;
@@ -145,6 +395,15 @@ void EVENT_USB_Device_Disconnect(void)
 void EVENT_USB_Device_ControlRequest(void)
 {
     CDC_Device_ProcessControlRequest(&interface);
+#if BRIDGE_MODE
+    CDC_Device_ProcessControlRequest(&bridge_interface);
+#endif
+#if MASS_STORAGE
+    MS_Device_ProcessControlRequest(&storage_interface);
+#endif
+#if NETWORK
+    RNDIS_Device_ProcessControlRequest(&network_interface);
+#endif
 }
 
 void EVENT_USB_Device_StartOfFrame(void)
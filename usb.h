@@ -6,14 +6,31 @@
 //**********************************************************************************
 
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifndef DOME_HEARTBEAT_USB_H
 #define DOME_HEARTBEAT_USB_H
 
 void usb_initialize(void);
-bool usb_can_read(void);
-int16_t usb_read(void);
-void usb_write(uint8_t b);
+uint8_t usb_read_data(uint8_t *data, uint8_t length);
+bool usb_write(uint8_t b);
+bool usb_write_data(const uint8_t *data, uint16_t length);
+bool usb_line_state_changed(void);
+
+#if BRIDGE_MODE
+uint8_t usb_bridge_read_data(uint8_t *data, uint8_t length);
+void usb_bridge_write_data(const uint8_t *data, uint8_t length);
+#endif
+
+#if MASS_STORAGE
+void usb_storage_poll(void);
+#endif
+
+#if NETWORK
+uint16_t usb_network_read(uint8_t *frame, uint16_t length);
+void usb_network_write(uint8_t *frame, uint16_t length);
+void usb_network_poll(void);
+#endif
 
 #endif
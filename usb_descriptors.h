@@ -55,7 +55,95 @@
 		#define CDC_NOTIFICATION_EPSIZE        8
 
 		/** Size in bytes of the CDC data IN and OUT endpoints. */
-		#define CDC_TXRX_EPSIZE                16
+		#define CDC_TXRX_EPSIZE                CDC_PACKET_SIZE
+
+		/** Number of banks used by each of the CDC data IN and OUT endpoints. */
+		#define CDC_TXRX_BANKS                 CDC_DATA_BANKS
+
+		#if BRIDGE_MODE
+		/** Endpoint address of the dome bridge CDC device-to-host notification IN endpoint. */
+		#define BRIDGE_NOTIFICATION_EPADDR     (ENDPOINT_DIR_IN  | 1)
+
+		/** Endpoint address of the dome bridge CDC device-to-host data IN endpoint. */
+		#define BRIDGE_TX_EPADDR               (ENDPOINT_DIR_IN  | 5)
+
+		/** Endpoint address of the dome bridge CDC host-to-device data OUT endpoint. */
+		#define BRIDGE_RX_EPADDR               (ENDPOINT_DIR_OUT | 6)
+		#endif
+
+		#if MASS_STORAGE
+		/** Endpoint address of the Mass Storage device-to-host data IN endpoint. */
+		#define MASS_STORAGE_IN_EPADDR         (ENDPOINT_DIR_IN  | 5)
+
+		/** Endpoint address of the Mass Storage host-to-device data OUT endpoint. */
+		#define MASS_STORAGE_OUT_EPADDR        (ENDPOINT_DIR_OUT | 6)
+
+		/** Size in bytes of the Mass Storage data endpoints. */
+		#define MASS_STORAGE_IO_EPSIZE         64
+		#endif
+
+		#if NETWORK
+		/** Endpoint address of the RNDIS device-to-host notification IN endpoint. */
+		#define RNDIS_NOTIFICATION_EPADDR      (ENDPOINT_DIR_IN  | 1)
+
+		/** Endpoint address of the RNDIS device-to-host data IN endpoint. */
+		#define RNDIS_TX_EPADDR                (ENDPOINT_DIR_IN  | 5)
+
+		/** Endpoint address of the RNDIS host-to-device data OUT endpoint. */
+		#define RNDIS_RX_EPADDR                (ENDPOINT_DIR_OUT | 6)
+
+		/** Size in bytes of the RNDIS device-to-host notification IN endpoint. */
+		#define RNDIS_NOTIFICATION_EPSIZE      8
+
+		/** Size in bytes of the RNDIS data endpoints. */
+		#define RNDIS_TXRX_EPSIZE              64
+		#endif
+
+		/** Bytes of endpoint DPRAM used by the Mass Storage endpoints. */
+		#if MASS_STORAGE
+		#define MASS_STORAGE_DPRAM_USED        (2 * MASS_STORAGE_IO_EPSIZE)
+		#else
+		#define MASS_STORAGE_DPRAM_USED        0
+		#endif
+
+		/** Bytes of endpoint DPRAM used by the RNDIS endpoints. */
+		#if NETWORK
+		#define RNDIS_DPRAM_USED               (RNDIS_NOTIFICATION_EPSIZE + 2 * RNDIS_TXRX_EPSIZE)
+		#else
+		#define RNDIS_DPRAM_USED               0
+		#endif
+
+		/** Number of CDC interfaces (each with a notification and a pair of data endpoints). */
+		#if BRIDGE_MODE
+		#define CDC_INTERFACE_COUNT            2
+		#else
+		#define CDC_INTERFACE_COUNT            1
+		#endif
+
+		/** Bytes of endpoint DPRAM used by the control, CDC, Mass Storage and RNDIS endpoints. */
+		#define ENDPOINT_DPRAM_USED            (FIXED_CONTROL_ENDPOINT_SIZE + CDC_INTERFACE_COUNT * \
+		                                        (CDC_NOTIFICATION_EPSIZE + 2 * CDC_TXRX_BANKS * CDC_TXRX_EPSIZE) + \
+		                                        MASS_STORAGE_DPRAM_USED + RNDIS_DPRAM_USED)
+
+		/** Bytes of endpoint DPRAM available on the ATmega32u4. */
+		#define ENDPOINT_DPRAM_SIZE            832
+
+	/* Preprocessor Checks: */
+		#if (CDC_TXRX_EPSIZE != 8) && (CDC_TXRX_EPSIZE != 16) && (CDC_TXRX_EPSIZE != 32) && (CDC_TXRX_EPSIZE != 64)
+			#error CDC_PACKET_SIZE must be 8, 16, 32 or 64.
+		#endif
+
+		#if (CDC_TXRX_BANKS != 1) && (CDC_TXRX_BANKS != 2)
+			#error CDC_DATA_BANKS must be 1 or 2.
+		#endif
+
+		#if (BRIDGE_MODE + MASS_STORAGE + NETWORK) > 1
+			#error BRIDGE_MODE, MASS_STORAGE and NETWORK all need endpoints 5 and 6, so only one can be enabled.
+		#endif
+
+		#if (ENDPOINT_DPRAM_USED > ENDPOINT_DPRAM_SIZE)
+			#error The configured endpoints do not fit in the endpoint DPRAM.
+		#endif
 
 	/* Type Defines: */
 		/** Type define for the device configuration descriptor structure. This must be defined in the
@@ -66,6 +154,11 @@
 		{
 			USB_Descriptor_Configuration_Header_t    Config;
 
+		#if BRIDGE_MODE || MASS_STORAGE || NETWORK
+			// CDC Interface Association
+			USB_Descriptor_Interface_Association_t   CDC_IAD;
+		#endif
+
 			// CDC Command Interface
 			USB_Descriptor_Interface_t               CDC_CCI_Interface;
 			USB_CDC_Descriptor_FunctionalHeader_t    CDC_Functional_Header;
@@ -77,6 +170,47 @@
 			USB_Descriptor_Interface_t               CDC_DCI_Interface;
 			USB_Descriptor_Endpoint_t                CDC_DataOutEndpoint;
 			USB_Descriptor_Endpoint_t                CDC_DataInEndpoint;
+
+		#if BRIDGE_MODE
+			// Dome Bridge CDC Interface Association
+			USB_Descriptor_Interface_Association_t   Bridge_IAD;
+
+			// Dome Bridge CDC Command Interface
+			USB_Descriptor_Interface_t               Bridge_CCI_Interface;
+			USB_CDC_Descriptor_FunctionalHeader_t    Bridge_Functional_Header;
+			USB_CDC_Descriptor_FunctionalACM_t       Bridge_Functional_ACM;
+			USB_CDC_Descriptor_FunctionalUnion_t     Bridge_Functional_Union;
+			USB_Descriptor_Endpoint_t                Bridge_NotificationEndpoint;
+
+			// Dome Bridge CDC Data Interface
+			USB_Descriptor_Interface_t               Bridge_DCI_Interface;
+			USB_Descriptor_Endpoint_t                Bridge_DataOutEndpoint;
+			USB_Descriptor_Endpoint_t                Bridge_DataInEndpoint;
+		#endif
+
+		#if NETWORK
+			// RNDIS Interface Association
+			USB_Descriptor_Interface_Association_t   RNDIS_IAD;
+
+			// RNDIS Control Interface
+			USB_Descriptor_Interface_t               RNDIS_CCI_Interface;
+			USB_CDC_Descriptor_FunctionalHeader_t    RNDIS_Functional_Header;
+			USB_CDC_Descriptor_FunctionalACM_t       RNDIS_Functional_ACM;
+			USB_CDC_Descriptor_FunctionalUnion_t     RNDIS_Functional_Union;
+			USB_Descriptor_Endpoint_t                RNDIS_NotificationEndpoint;
+
+			// RNDIS Data Interface
+			USB_Descriptor_Interface_t               RNDIS_DCI_Interface;
+			USB_Descriptor_Endpoint_t                RNDIS_DataOutEndpoint;
+			USB_Descriptor_Endpoint_t                RNDIS_DataInEndpoint;
+		#endif
+
+		#if MASS_STORAGE
+			// Mass Storage Interface
+			USB_Descriptor_Interface_t               MS_Interface;
+			USB_Descriptor_Endpoint_t                MS_DataInEndpoint;
+			USB_Descriptor_Endpoint_t                MS_DataOutEndpoint;
+		#endif
 		} USB_Descriptor_Configuration_t;
 
 		/** Enum for the device interface descriptor IDs within the device. Each interface descriptor
@@ -87,6 +221,18 @@
 		{
 			INTERFACE_ID_CDC_CCI = 0, /**< CDC CCI interface descriptor ID */
 			INTERFACE_ID_CDC_DCI = 1, /**< CDC DCI interface descriptor ID */
+		#if BRIDGE_MODE
+			INTERFACE_ID_BRIDGE_CCI = 2, /**< Dome bridge CDC CCI interface descriptor ID */
+			INTERFACE_ID_BRIDGE_DCI = 3, /**< Dome bridge CDC DCI interface descriptor ID */
+		#endif
+		#if MASS_STORAGE
+			INTERFACE_ID_MASS_STORAGE = 2, /**< Mass Storage interface descriptor ID */
+		#endif
+		#if NETWORK
+			INTERFACE_ID_RNDIS_CCI = 2, /**< RNDIS control interface descriptor ID */
+			INTERFACE_ID_RNDIS_DCI = 3, /**< RNDIS data interface descriptor ID */
+		#endif
+			INTERFACE_ID_COUNT, /**< Total number of interfaces */
 		};
 
 		/** Enum for the device string descriptor IDs within the device. Each string descriptor should
@@ -98,6 +244,8 @@
 			STRING_ID_Language     = 0, /**< Supported Languages string descriptor ID (must be zero) */
 			STRING_ID_Manufacturer = 1, /**< Manufacturer string ID */
 			STRING_ID_Product      = 2, /**< Product string ID */
+			STRING_ID_Bridge       = 3, /**< Dome bridge interface string ID */
+			STRING_ID_Network      = 4, /**< RNDIS network interface string ID */
 		};
 
 	/* Function Prototypes: */